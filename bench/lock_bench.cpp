@@ -0,0 +1,132 @@
+/************************************************************
+ * lock_bench.cpp
+ *
+ * Contention benchmark for the VelocitySet bucket lock policies.
+ * Many threads hammer a handful of buckets; every lock() call is
+ * timed and the acquire latency distribution is reported per policy,
+ * together with total throughput.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O3 -march=native -pthread -I. \
+ *       bench/lock_bench.cpp -o lock_bench
+ *
+ * Usage:
+ *   ./lock_bench [threads=32] [milliseconds=1000]
+ *
+ * Each policy is run against 1, 2 and 4 buckets. The critical section
+ * is a real bucket operation (insert/erase in FlatStorage).
+ ************************************************************/
+
+#include "velocity_set.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    double ops_per_sec;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+template <typename Lock>
+Result run(size_t threads, size_t bucket_count, std::chrono::milliseconds duration) {
+    using BucketType = velocity::Bucket<uint64_t, velocity::FlatStorage, Lock>;
+    std::unique_ptr<BucketType[]> buckets(new BucketType[bucket_count]);
+
+    std::vector<std::vector<uint64_t>> latencies(threads);
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            std::vector<uint64_t>& samples = latencies[t];
+            samples.reserve(1 << 20);
+            while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t key = rng();
+                BucketType& bucket = buckets[key % bucket_count];
+                auto before = Clock::now();
+                bucket.lock.lock();
+                auto after = Clock::now();
+                // Keep each bucket small so the critical section stays short
+                if (!bucket.data_set.insert(key & 1023)) bucket.data_set.erase(key & 1023);
+                bucket.lock.unlock();
+                samples.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count()));
+            }
+        });
+    }
+
+    auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& worker : workers) worker.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    std::vector<uint64_t> all;
+    for (auto& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    std::sort(all.begin(), all.end());
+
+    return Result{static_cast<double>(all.size()) / seconds,
+                  percentile(all, 0.50),
+                  percentile(all, 0.99),
+                  percentile(all, 0.999),
+                  all.empty() ? 0 : all.back()};
+}
+
+template <typename Lock>
+void report(const char* name, size_t threads, std::chrono::milliseconds duration) {
+    for (size_t bucket_count : {1, 2, 4}) {
+        Result r = run<Lock>(threads, bucket_count, duration);
+        std::printf("%-12s %7zu %12.0f %10llu %10llu %10llu %12llu\n",
+                    name, bucket_count, r.ops_per_sec,
+                    static_cast<unsigned long long>(r.p50_ns),
+                    static_cast<unsigned long long>(r.p99_ns),
+                    static_cast<unsigned long long>(r.p999_ns),
+                    static_cast<unsigned long long>(r.max_ns));
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+    std::chrono::milliseconds duration(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000);
+
+    std::printf("threads=%zu duration=%lldms hardware_concurrency=%u\n",
+                threads, static_cast<long long>(duration.count()), std::thread::hardware_concurrency());
+    std::printf("%-12s %7s %12s %10s %10s %10s %12s\n",
+                "policy", "buckets", "ops/s", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+
+    report<velocity::SpinLock>("SpinLock", threads, duration);
+    report<velocity::BackoffSpinLock<>>("Backoff1024", threads, duration);
+    report<velocity::BackoffSpinLock<64>>("Backoff64", threads, duration);
+    report<velocity::RWSpinLock>("RWSpinLock", threads, duration);
+    report<velocity::FutexLock>("FutexLock", threads, duration);
+    report<velocity::TicketLock>("TicketLock", threads, duration);
+    report<velocity::McsLock>("McsLock", threads, duration);
+    return 0;
+}
@@ -0,0 +1,250 @@
+/************************************************************
+ * adaptive_storage_test.cpp
+ *
+ * Tests for AdaptiveStorage: contents against std::set through
+ * inline -> table -> bitmap transitions and back, the memory
+ * each representation takes (inline allocates nothing, a dense
+ * bitmap stays within the bits of the keys), moves in every
+ * representation, and use as a VelocitySet backend.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/adaptive_storage_test.cpp -o adaptive_storage_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Live heap bytes, to tell the representations apart from outside
+std::atomic<int64_t> g_heap_bytes{0};
+
+void* operator new(size_t size) {
+    void* block = std::malloc(size + 16);
+    if (block == nullptr) throw std::bad_alloc();
+    *static_cast<size_t*>(block) = size;
+    g_heap_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    return static_cast<char*>(block) + 16;
+}
+
+void operator delete(void* p) noexcept {
+    if (p == nullptr) return;
+    void* block = static_cast<char*>(p) - 16;
+    g_heap_bytes.fetch_sub(static_cast<int64_t>(*static_cast<size_t*>(block)), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+namespace
+{
+
+template <typename T>
+using Storage = velocity::AdaptiveStorage<T>;
+
+/** @brief Allocates with malloc, so expected contents do not count as heap bytes. */
+template <typename T>
+struct UntrackedAllocator {
+    using value_type = T;
+    UntrackedAllocator() = default;
+    template <typename U>
+    UntrackedAllocator(const UntrackedAllocator<U>&) noexcept {}
+    T* allocate(size_t n) {
+        void* block = std::malloc(n * sizeof(T));
+        if (block == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(block);
+    }
+    void deallocate(T* p, size_t) noexcept { std::free(p); }
+    template <typename U>
+    bool operator==(const UntrackedAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const UntrackedAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using KeySet = std::set<T, std::less<T>, UntrackedAllocator<T>>;
+
+template <typename T>
+void check_contents(const Storage<T>& storage, const KeySet<T>& expected) {
+    CHECK(storage.size() == expected.size());
+    KeySet<T> seen;
+    storage.for_each([&seen](const T& key) { CHECK(seen.insert(key).second); });
+    CHECK(seen == expected);
+    for (T key : expected) CHECK(storage.contains(key));
+}
+
+template <typename T>
+int64_t bytes_of(const std::vector<T>& keys) {
+    int64_t before = g_heap_bytes.load();
+    Storage<T> storage;
+    for (T key : keys) storage.insert(key);
+    return g_heap_bytes.load() - before;
+}
+
+// Up to 10 32-bit keys stay inline; more sparse keys need a table; more
+// dense keys a bitmap of about one bit each.
+void test_representations() {
+    std::vector<uint32_t> few = {9, 1, 5, 1000000, 3};
+    CHECK(bytes_of(few) == 0);
+    std::vector<uint32_t> sparse, dense;
+    for (uint32_t k = 0; k < 1000; ++k) {
+        sparse.push_back(k * 7919 + 13);
+        dense.push_back(500000 + k);
+    }
+    int64_t sparse_bytes = bytes_of(sparse);
+    int64_t dense_bytes = bytes_of(dense);
+    CHECK(sparse_bytes >= 1000 * 4); // At least the keys themselves
+    CHECK(dense_bytes <= 1000 / 8 * 2); // Bitmap plus the spare words of a run
+    std::vector<uint64_t> wide = {~uint64_t{0}, 0, 1, 2, 3};
+    CHECK(bytes_of(wide) == 0);
+}
+
+// Keys arrive dense, turn sparse, and are erased again: the contents stay
+// right through every promotion and demotion, and everything is freed once
+// the storage is small again.
+template <typename T>
+void check_transitions(T first) {
+    int64_t baseline = g_heap_bytes.load();
+    {
+        Storage<T> storage;
+        KeySet<T> expected;
+        auto insert = [&](T key) { CHECK(storage.insert(key) == expected.insert(key).second); };
+        auto erase = [&](T key) { CHECK(storage.erase(key) == (expected.erase(key) == 1)); };
+        for (int k = 0; k < 8; ++k) insert(static_cast<T>(first + k * 3)); // Inline
+        check_contents(storage, expected);
+        for (int k = 0; k < 3000; ++k) insert(static_cast<T>(first + k)); // Bitmap, extended upwards
+        check_contents(storage, expected);
+        for (int k = 1; k < 500; ++k) insert(static_cast<T>(first - k)); // Extended downwards
+        check_contents(storage, expected);
+        insert(static_cast<T>(first + 100000000)); // Too sparse: table
+        check_contents(storage, expected);
+        erase(static_cast<T>(first + 100000000));
+        for (int k = 0; k < 4096; ++k) insert(static_cast<T>(first + 4 * k)); // Dense again at a doubling
+        check_contents(storage, expected);
+        for (int k = -499; k < 16384; k += 1) {
+            if (k % 97 != 0) erase(static_cast<T>(first + k)); // Sparse bitmap: table, then inline
+        }
+        check_contents(storage, expected);
+        CHECK(storage.size() < 200);
+        while (expected.size() > 2) erase(*expected.begin()); // Half the inline capacity, for any T
+        check_contents(storage, expected);
+        CHECK(g_heap_bytes.load() == baseline); // Back inline
+        for (int k = 0; k < 100; ++k) insert(static_cast<T>(first + k * 1000));
+        storage.clear();
+        expected.clear();
+        check_contents(storage, expected);
+        CHECK(g_heap_bytes.load() == baseline);
+    }
+    CHECK(g_heap_bytes.load() == baseline);
+}
+
+void test_transitions() {
+    check_transitions<uint32_t>(1u << 20);
+    check_transitions<int32_t>(-1000);     // Spans zero
+    check_transitions<uint64_t>(uint64_t{1} << 40);
+    check_transitions<int64_t>(-(int64_t{1} << 40));
+    check_transitions<int16_t>(-2000);
+}
+
+// Keys at the very top of the type: bitmap ranges must not wrap around.
+void test_extremes() {
+    Storage<uint32_t> storage;
+    KeySet<uint32_t> expected;
+    uint32_t top = std::numeric_limits<uint32_t>::max();
+    for (uint32_t k = 0; k < 2000; ++k) {
+        storage.insert(top - k);
+        expected.insert(top - k);
+    }
+    storage.insert(0);
+    expected.insert(0);
+    check_contents(storage, expected);
+    CHECK(!storage.contains(top - 2000) && !storage.contains(1));
+}
+
+void test_moves() {
+    std::vector<std::vector<uint64_t>> shapes(3);
+    for (uint64_t k = 0; k < 5; ++k) shapes[0].push_back(k * 1000); // Inline
+    for (uint64_t k = 0; k < 500; ++k) shapes[1].push_back(k * 7919); // Table
+    for (uint64_t k = 0; k < 500; ++k) shapes[2].push_back(k + 77); // Bitmap
+    for (const std::vector<uint64_t>& keys : shapes) {
+        KeySet<uint64_t> expected(keys.begin(), keys.end());
+        Storage<uint64_t> source;
+        for (uint64_t key : keys) source.insert(key);
+        Storage<uint64_t> moved(std::move(source));
+        check_contents(moved, expected);
+        check_contents(source, {});
+        Storage<uint64_t> target;
+        for (uint64_t k = 0; k < 300; ++k) target.insert(k * 13); // Replaced by the move
+        target = std::move(moved);
+        check_contents(target, expected);
+        check_contents(moved, {});
+        source.insert(5); // A moved-from storage is reusable
+        CHECK(source.contains(5) && source.size() == 1);
+    }
+}
+
+// A random mix of clustered and scattered keys, compared with std::set
+void test_random() {
+    Storage<uint32_t> storage;
+    KeySet<uint32_t> expected;
+    std::mt19937 rng(17);
+    for (int op = 0; op < 300000; ++op) {
+        uint32_t key = rng() % 4 == 0 ? rng() : 1000000 + rng() % 5000;
+        if (rng() % 3 == 0) {
+            CHECK(storage.erase(key) == (expected.erase(key) == 1));
+        } else {
+            CHECK(storage.insert(key) == expected.insert(key).second);
+        }
+        CHECK(storage.size() == expected.size());
+    }
+    check_contents(storage, expected);
+}
+
+// As a VelocitySet backend: few buckets, so they cycle through every
+// representation while threads insert and erase their own keys.
+void test_in_set() {
+    velocity::VelocitySet<uint32_t, velocity::AdaptiveStorage> set(4, 1 << 20);
+    auto dense_key = [](uint32_t t, uint32_t k) { return t << 28 | k; };
+    auto sparse_key = [](uint32_t t, uint32_t k) { return t << 28 | 1 << 27 | k * 4099; };
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint32_t k = 0; k < 20000; ++k) set.Insert(dense_key(t, k));
+            for (uint32_t k = 0; k < 20000; ++k) set.Insert(sparse_key(t, k));
+            for (uint32_t k = 0; k < 20000; k += 2) {
+                set.Remove(dense_key(t, k));
+                set.Remove(sparse_key(t, k));
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(set.SizeExact() == 4 * 20000);
+    for (uint32_t t = 0; t < 4; ++t) {
+        for (uint32_t k = 0; k < 20000; ++k) {
+            CHECK(set.Contains(dense_key(t, k)) == (k % 2 == 1));
+            CHECK(set.Contains(sparse_key(t, k)) == (k % 2 == 1));
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_representations();
+    test_transitions();
+    test_extremes();
+    test_moves();
+    test_random();
+    test_in_set();
+    std::puts("adaptive_storage_test: all passed");
+    return 0;
+}
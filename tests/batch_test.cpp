@@ -0,0 +1,133 @@
+/************************************************************
+ * batch_test.cpp
+ *
+ * Tests for InsertBatch and RemoveBatch: results and per-key
+ * flags against one-at-a-time semantics, with repeated keys
+ * inside a batch, across bucket layouts and key modes; and
+ * ContainsBatch against Contains.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/batch_test.cpp -o batch_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// A batch must flag exactly the keys a loop of TryInsert/TryRemove would:
+// the first occurrence of a new key, and never its repeats.
+template <typename Set, typename Key>
+void check_flags(Set& set, uint64_t range, size_t batch) {
+    std::mt19937_64 rng(5);
+    std::set<Key> expected;
+    for (int round = 0; round < 10; ++round) {
+        std::vector<Key> keys(batch);
+        for (Key& key : keys) key = static_cast<Key>(rng() % range);
+        std::vector<uint8_t> flags(batch, 7);
+        bool insert = round % 3 != 2;
+        size_t changed = insert ? set.InsertBatch(keys.data(), keys.size(), flags.data())
+                                : set.RemoveBatch(keys.data(), keys.size(), flags.data());
+        size_t expected_changed = 0;
+        for (size_t i = 0; i < batch; ++i) {
+            bool changes = insert ? expected.insert(keys[i]).second : expected.erase(keys[i]) == 1;
+            CHECK(flags[i] == changes);
+            expected_changed += changes;
+        }
+        CHECK(changed == expected_changed);
+        CHECK(set.Size() == expected.size());
+    }
+    for (Key key : expected) CHECK(set.Contains(key));
+    CHECK(set.SizeExact() == expected.size());
+}
+
+void test_flags() {
+    velocity::VelocitySet<uint64_t> set(4, 8); // Grows during the batches
+    check_flags<decltype(set), uint64_t>(set, 20000, 30000);
+    velocity::VelocitySet<int32_t, velocity::FlatStorage, velocity::Murmur3Hash> flat(64, 0, {}, 4);
+    check_flags<decltype(flat), int32_t>(flat, 500, 5000); // Mostly repeats
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::SwissStorage>;
+    DenseSet dense(DenseSet::DenseRange{0, 10000});
+    check_flags<DenseSet, uint64_t>(dense, 20000, 10000); // Half in the bitmap
+    velocity::VelocitySet<int16_t> small;
+    check_flags<decltype(small), int16_t>(small, 65536, 20000);
+}
+
+void test_empty_and_null_flags() {
+    velocity::VelocitySet<uint64_t> set;
+    CHECK(set.InsertBatch(nullptr, 0) == 0);
+    std::vector<uint64_t> keys = {1, 2, 2, 3, 1};
+    CHECK(set.InsertBatch(keys.data(), keys.size()) == 3);
+    CHECK(set.RemoveBatch(keys.data(), keys.size()) == 3);
+    CHECK(set.Size() == 0);
+}
+
+// Batches from several threads on overlapping keys: every key is added by
+// exactly one of them.
+void test_concurrent() {
+    velocity::VelocitySet<uint64_t> set(8);
+    constexpr size_t kKeys = 50000;
+    std::vector<size_t> added(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, &added, t]() {
+            std::vector<uint64_t> keys(kKeys);
+            for (size_t i = 0; i < kKeys; ++i) keys[i] = (i * 7 + t * 13) % kKeys;
+            added[t] = set.InsertBatch(keys.data(), keys.size());
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(added[0] + added[1] + added[2] + added[3] == kKeys);
+    CHECK(set.SizeExact() == kKeys);
+}
+
+// ContainsBatch must agree with Contains for every key, for batch sizes
+// that do not fill the last prefetch group.
+template <typename Set>
+void check_contains_batch(Set& set) {
+    for (uint64_t k = 0; k < 30000; k += 3) set.Insert(k);
+    for (size_t count : {0, 1, 15, 16, 17, 1000, 30001}) {
+        std::vector<uint64_t> keys(count);
+        for (size_t i = 0; i < count; ++i) keys[i] = (i * 7919) % 30000;
+        std::vector<uint8_t> out(count, 7);
+        size_t found = set.ContainsBatch(keys.data(), count, out.data());
+        size_t expected = 0;
+        for (size_t i = 0; i < count; ++i) {
+            CHECK(out[i] == (keys[i] % 3 == 0));
+            expected += out[i];
+        }
+        CHECK(found == expected);
+    }
+}
+
+void test_contains_batch() {
+    velocity::VelocitySet<uint64_t> set(4);
+    check_contains_batch(set);
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage, velocity::Murmur3Hash> flat(4); // Prefetches slots
+    check_contains_batch(flat);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    DenseSet dense(DenseSet::DenseRange{10000, 5000});
+    check_contains_batch(dense);
+    velocity::LockFreeVelocitySet<uint64_t> lock_free(20000);
+    check_contains_batch(lock_free);
+}
+
+} // namespace
+
+int main() {
+    test_flags();
+    test_empty_and_null_flags();
+    test_concurrent();
+    test_contains_batch();
+    std::puts("batch_test: all passed");
+    return 0;
+}
@@ -0,0 +1,138 @@
+/************************************************************
+ * clear_test.cpp
+ *
+ * Tests for constant-time Clear: stale buckets read as empty
+ * and are reset on reuse or by ReclaimCleared, the 16-bit
+ * generation wraps without reviving old keys, and the count
+ * stays right when Clear races writers.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/clear_test.cpp -o clear_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+template <typename Set>
+void check_cleared(Set& set, uint64_t keys) {
+    for (uint64_t k = 0; k < keys; ++k) set.Insert(k);
+    set.Clear();
+    CHECK(set.Size() == 0);
+    CHECK(set.SizeExact() == 0);
+    CHECK(set.Snapshot().Size() == 0);
+    size_t visited = 0;
+    set.ForEach([&visited](uint64_t) { ++visited; });
+    CHECK(visited == 0);
+    for (uint64_t k = 0; k < keys; ++k) CHECK(!set.Contains(k));
+    CHECK(!set.TryRemove(1));
+    CHECK(!set.Replace(2, 3));
+
+    for (uint64_t k = 0; k < keys; k += 2) CHECK(set.TryInsert(k)); // Stale copies do not count
+    CHECK(set.Size() == keys / 2);
+    CHECK(set.SizeExact() == keys / 2);
+    for (uint64_t k = 0; k < keys; ++k) CHECK(set.Contains(k) == (k % 2 == 0));
+}
+
+void test_clear() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_cleared(set, 20000);
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage> flat(4, 8);
+    check_cleared(flat, 20000);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::SwissStorage>;
+    DenseSet dense(DenseSet::DenseRange{0, 5000});
+    check_cleared(dense, 20000);
+    velocity::VelocitySet<uint16_t> small;
+    check_cleared(small, 65536);
+}
+
+// ReclaimCleared resets exactly the buckets still holding old contents.
+template <typename Set>
+void check_reclaim() {
+    Set set(64, 1 << 20); // Never splits
+    for (uint64_t k = 0; k < 6400; ++k) set.Insert(k);
+    CHECK(set.ReclaimCleared() == 0);
+    set.Clear();
+    for (uint64_t k = 0; k < 16; ++k) set.Insert(k); // Resets up to 16 buckets lazily
+    size_t reclaimed = set.ReclaimCleared();
+    CHECK(reclaimed >= 48 && reclaimed < 64);
+    CHECK(set.ReclaimCleared() == 0);
+    CHECK(set.SizeExact() == 16);
+    for (uint64_t k = 0; k < 6400; ++k) CHECK(set.Contains(k) == (k < 16));
+}
+
+void test_reclaim() {
+    check_reclaim<velocity::VelocitySet<uint64_t>>();
+    check_reclaim<velocity::VelocitySet<uint64_t, velocity::FlatStorage>>(); // Emptied, memory kept
+    check_reclaim<velocity::VelocitySet<uint64_t, velocity::SwissStorage>>();
+    CHECK(velocity::VelocitySet<uint8_t>().ReclaimCleared() == 0);
+}
+
+// After 65536 clears the generation tag of untouched buckets comes round
+// again; their contents must stay dead.
+void test_generation_wrap() {
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage> set(16, 1 << 20);
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k); // Generation 0
+    set.Clear();
+    set.Insert(5000); // One bucket of generation 1
+    for (int i = 0; i < 65535; ++i) set.Clear();
+    for (uint64_t k = 0; k < 1000; ++k) CHECK(!set.Contains(k)); // Generation 0 again
+    CHECK(set.Size() == 0 && set.SizeExact() == 0);
+    set.Clear();
+    CHECK(!set.Contains(5000)); // Generation 1 again
+    CHECK(set.Snapshot().Size() == 0);
+    CHECK(set.TryInsert(7));
+    CHECK(set.Size() == 1 && set.SizeExact() == 1);
+}
+
+// Writers keep inserting while Clear runs. Whatever survives, the maintained
+// count must match the keys actually present.
+void test_concurrent_clear() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (uint64_t t = 0; t < 2; ++t) {
+        writers.emplace_back([&set, &done, t]() {
+            for (uint64_t k = 0; !done.load(); ++k) {
+                set.Insert((t << 32) + k % 50000);
+                set.Remove((t << 32) + (k + 25000) % 50000);
+            }
+        });
+    }
+    std::thread reader([&set, &done]() {
+        while (!done.load()) {
+            for (uint64_t k = 0; k < 1000; ++k) set.Contains(k);
+        }
+    });
+    for (int i = 0; i < 200; ++i) {
+        set.Clear();
+        if (i % 50 == 0) set.ReclaimCleared();
+        std::this_thread::yield();
+    }
+    done.store(true);
+    for (std::thread& writer : writers) writer.join();
+    reader.join();
+    size_t present = 0;
+    set.ForEach([&present](uint64_t) { ++present; });
+    CHECK(set.Size() == present);
+    CHECK(set.SizeExact() == present);
+}
+
+} // namespace
+
+int main() {
+    test_clear();
+    test_reclaim();
+    test_generation_wrap();
+    test_concurrent_clear();
+    std::puts("clear_test: all passed");
+    return 0;
+}
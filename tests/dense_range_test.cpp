@@ -0,0 +1,163 @@
+/************************************************************
+ * dense_range_test.cpp
+ *
+ * Tests for DenseRange sets: keys at and around the range
+ * edges, invalid ranges, the maintained count through every
+ * update path, Size() in constant time on a large range, and
+ * range and spilled keys updated concurrently.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/dense_range_test.cpp -o dense_range_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Set = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+
+void test_edges() {
+    Set set(Set::DenseRange{1000, 64});
+    for (uint64_t key : {uint64_t{0}, uint64_t{999}, uint64_t{1000}, uint64_t{1063}, uint64_t{1064}}) {
+        CHECK(set.TryInsert(key));
+        CHECK(!set.TryInsert(key));
+        CHECK(set.Contains(key));
+    }
+    CHECK(!set.Contains(1001) && !set.Contains(1062));
+    CHECK(set.Size() == 5 && set.SizeExact() == 5);
+    CHECK(set.TryRemove(1000) && set.TryRemove(1064));
+    CHECK(set.Size() == 3);
+
+    uint64_t top = std::numeric_limits<uint64_t>::max();
+    Set high(Set::DenseRange{top - 99, 100}); // Ends at the largest key
+    CHECK(high.TryInsert(top) && high.TryInsert(top - 99) && high.TryInsert(top - 100));
+    CHECK(high.Contains(top) && high.Size() == 3);
+
+    velocity::VelocitySet<int32_t> negative(velocity::VelocitySet<int32_t>::DenseRange{-50, 100});
+    for (int32_t k = -60; k < 60; ++k) negative.Insert(k);
+    CHECK(negative.Size() == 120);
+    for (int32_t k = -60; k < 60; ++k) CHECK(negative.Contains(k));
+}
+
+void test_invalid_ranges() {
+    auto rejected = [](uint64_t base, size_t size) {
+        try {
+            Set set(Set::DenseRange{base, size});
+        } catch (const std::invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    CHECK(rejected(0, 0));
+    CHECK(rejected(std::numeric_limits<uint64_t>::max() - 9, 11)); // Past the largest key
+    CHECK(!rejected(std::numeric_limits<uint64_t>::max() - 9, 10));
+}
+
+// Size() follows every update path that touches the bitmap, without
+// scanning it.
+void test_count() {
+    Set set(Set::DenseRange{0, 10000});
+    std::set<uint64_t> expected;
+    auto check_size = [&]() {
+        CHECK(set.Size() == expected.size());
+        CHECK(set.SizeExact() == expected.size());
+    };
+    for (uint64_t k = 0; k < 20000; k += 3) {
+        set.Insert(k);
+        expected.insert(k);
+    }
+    check_size();
+    CHECK(set.Replace(3, 4) && set.Replace(6, 7000)); // Same word, another word
+    CHECK(set.Replace(9, 12)); // Onto a present key
+    CHECK(set.Replace(15, 50001) && set.Replace(10002, 16)); // Out of and into the range
+    for (uint64_t k : {3, 6, 9, 15, 10002}) expected.erase(k);
+    for (uint64_t k : {4, 7000, 50001, 16}) expected.insert(k);
+    check_size();
+
+    std::vector<uint64_t> batch;
+    for (uint64_t k = 0; k < 20000; k += 2) batch.push_back(k);
+    set.InsertBatch(batch.data(), batch.size());
+    expected.insert(batch.begin(), batch.end());
+    check_size();
+    set.RemoveBatch(batch.data(), batch.size() / 2);
+    for (size_t i = 0; i < batch.size() / 2; ++i) expected.erase(batch[i]);
+    check_size();
+
+    Set other(Set::DenseRange{0, 10000});
+    for (uint64_t k = 0; k < 20000; k += 5) other.Insert(k);
+    set.UnionWith(other);
+    for (uint64_t k = 0; k < 20000; k += 5) expected.insert(k);
+    check_size();
+    set.IntersectWith(other);
+    for (auto it = expected.begin(); it != expected.end();) it = *it % 5 == 0 ? std::next(it) : expected.erase(it);
+    check_size();
+    std::unique_ptr<Set> both = Set::Intersect(set, other);
+    CHECK(both->Size() == expected.size());
+    set.Subtract(other);
+    expected.clear();
+    check_size();
+
+    TempDir dir;
+    std::string path = dir.File("dense.vset");
+    other.SaveTo(path);
+    set.Clear();
+    CHECK(set.Size() == 0);
+    CHECK(set.LoadFrom(path) == 4000);
+    CHECK(set.Size() == 4000 && set.SizeExact() == 4000);
+}
+
+// With 2^30 possible keys a bitmap scan reads 16M words; 1000 Size() calls
+// must not.
+void test_size_is_constant_time() {
+    Set set(Set::DenseRange{0, size_t{1} << 30});
+    set.Insert(5);
+    set.Insert((uint64_t{1} << 30) - 1);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i) CHECK(set.Size() == 2);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200));
+}
+
+// Writers share words of the range and buckets; the count is exact after.
+void test_concurrent() {
+    Set set(Set::DenseRange{0, 1 << 16});
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, t]() {
+            for (int round = 0; round < 10; ++round) {
+                for (uint64_t k = t; k < (1 << 17); k += 4) set.Insert(k); // Half in the range
+                for (uint64_t k = t; k < (1 << 17); k += 8) set.Remove(k);
+                for (uint64_t k = t + 4; k < (1 << 17); k += 64) set.Replace(k, k + 1); // A key of thread t + 1
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    size_t present = 0;
+    set.ForEach([&present](uint64_t) { ++present; });
+    CHECK(set.Size() == present);
+    CHECK(set.SizeExact() == present);
+}
+
+} // namespace
+
+int main() {
+    test_edges();
+    test_invalid_ranges();
+    test_count();
+    test_size_is_constant_time();
+    test_concurrent();
+    std::puts("dense_range_test: all passed");
+    return 0;
+}
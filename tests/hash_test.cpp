@@ -0,0 +1,84 @@
+/************************************************************
+ * hash_test.cpp
+ *
+ * Tests for the hash policies: how well each spreads strided
+ * and packed keys over the low (bucket-selecting) bits, seeded
+ * hashing, and membership in sets using each policy.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/hash_test.cpp -o hash_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+namespace
+{
+
+// Number of the 256 buckets selected by the low 8 bits that keys reach.
+template <typename Hash>
+size_t buckets_reached(const Hash& hash, const std::vector<uint64_t>& keys) {
+    std::set<size_t> buckets;
+    for (uint64_t key : keys) buckets.insert(hash(key) & 255);
+    return buckets.size();
+}
+
+void test_spread() {
+    std::vector<uint64_t> strided, packed;
+    for (uint64_t k = 0; k < 4096; ++k) {
+        strided.push_back(k * 4096);
+        packed.push_back((k % 16) << 48 | (k / 16) << 20);
+    }
+    CHECK(buckets_reached(velocity::IdentityHash(), strided) == 1); // The clustering the mixers fix
+    CHECK(buckets_reached(velocity::FibonacciHash(), strided) > 200);
+    CHECK(buckets_reached(velocity::Murmur3Hash(), strided) > 200);
+    CHECK(buckets_reached(velocity::Murmur3Hash(), packed) > 200);
+    CHECK(buckets_reached(velocity::SeededHash(), packed) > 200);
+}
+
+void test_seeded() {
+    velocity::SeededHash a(1, 2), b(1, 2), c(1, 3);
+    CHECK(a == b);
+    CHECK(!(a == c));
+    size_t differing = 0;
+    for (uint64_t k = 0; k < 1000; ++k) {
+        CHECK(a(k) == b(k));
+        differing += a(k) != c(k);
+    }
+    CHECK(differing > 990);
+    CHECK(!(velocity::SeededHash() == velocity::SeededHash())); // Random seeds
+}
+
+template <typename Hash>
+void check_membership(const Hash& hash) {
+    velocity::VelocitySet<uint64_t, velocity::UnorderedSetStorage, Hash> set(4, 8, hash);
+    for (uint64_t k = 0; k < 20000; ++k) set.Insert(k * 4096);
+    for (uint64_t k = 0; k < 20000; ++k) {
+        CHECK(set.Contains(k * 4096));
+        CHECK(!set.Contains(k * 4096 + 1));
+    }
+    for (uint64_t k = 0; k < 20000; k += 2) set.Remove(k * 4096);
+    CHECK(set.SizeExact() == 10000);
+}
+
+void test_membership() {
+    check_membership(velocity::IdentityHash());
+    check_membership(velocity::FibonacciHash());
+    check_membership(velocity::Murmur3Hash());
+    check_membership(velocity::SeededHash(7, 8));
+}
+
+} // namespace
+
+int main() {
+    test_spread();
+    test_seeded();
+    test_membership();
+    std::puts("hash_test: all passed");
+    return 0;
+}
@@ -0,0 +1,140 @@
+/************************************************************
+ * iteration_test.cpp
+ *
+ * Tests for ForEach and ParallelForEach: every key visited
+ * exactly once across bucket layouts and key modes, exceptions
+ * from the callback, and walks racing writers and resizing.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/iteration_test.cpp -o iteration_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+// Visit counts per key from a ForEach (num_threads == 0) or a
+// ParallelForEach with num_threads workers.
+template <typename Set, typename Key>
+std::unordered_map<Key, int> visits(const Set& set, size_t num_threads) {
+    std::unordered_map<Key, int> seen;
+    std::mutex mutex;
+    auto record = [&](const Key& key) {
+        std::lock_guard<std::mutex> guard(mutex);
+        ++seen[key];
+    };
+    if (num_threads == 0) {
+        set.ForEach(record);
+    } else {
+        set.ParallelForEach(record, num_threads);
+    }
+    return seen;
+}
+
+template <typename Set, typename Key>
+void check_visits(Set& set, const std::vector<Key>& keys) {
+    for (Key key : keys) set.Insert(key);
+    for (size_t num_threads : {0, 1, 3, 8}) {
+        std::unordered_map<Key, int> seen = visits<Set, Key>(set, num_threads);
+        CHECK(seen.size() == keys.size());
+        for (Key key : keys) CHECK(seen[key] == 1);
+    }
+}
+
+void test_visits_each_key_once() {
+    std::vector<uint64_t> keys;
+    for (uint64_t k = 0; k < 50000; ++k) keys.push_back(k * 13);
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_visits(set, keys);
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage, velocity::Murmur3Hash> flat(4, 8);
+    check_visits(flat, keys);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::SwissStorage>;
+    DenseSet dense(DenseSet::DenseRange{100000, 200000}); // Keys on both sides of the range
+    check_visits(dense, keys);
+
+    std::vector<char> chars;
+    for (int c = -128; c < 128; c += 3) chars.push_back(static_cast<char>(c));
+    velocity::VelocitySet<char> small;
+    check_visits(small, chars);
+
+    using Set = velocity::VelocitySet<uint64_t>;
+    Set empty;
+    CHECK((visits<Set, uint64_t>(empty, 0).empty()));
+    CHECK((visits<Set, uint64_t>(empty, 4).empty()));
+}
+
+// A throwing callback stops the walk, and the layout pins are released:
+// the set still resizes afterwards.
+void test_exceptions() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k);
+    for (size_t num_threads : {0, 4}) {
+        bool thrown = false;
+        try {
+            auto fail = [](uint64_t key) {
+                if (key == 500) throw std::runtime_error("stop");
+            };
+            if (num_threads == 0) {
+                set.ForEach(fail);
+            } else {
+                set.ParallelForEach(fail, num_threads);
+            }
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+    size_t buckets = set.GetBucketCount();
+    for (uint64_t k = 1000; k < 20000; ++k) set.Insert(k);
+    CHECK(set.GetBucketCount() > buckets);
+}
+
+// Walks race writers that make the table split and merge. Keys that stay
+// in the set are seen exactly once by every walk; keys never inserted are
+// never seen.
+void test_concurrent_writers() {
+    constexpr uint64_t kStable = 5000;
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage> set(2, 4);
+    for (uint64_t k = 0; k < kStable; ++k) set.Insert(k);
+    std::atomic<bool> done{false};
+    std::thread writer([&set, &done]() {
+        for (int round = 0; round < 20; ++round) {
+            for (uint64_t k = 0; k < 20000; ++k) set.Insert((uint64_t{1} << 32) + k);
+            for (uint64_t k = 0; k < 20000; ++k) set.Remove((uint64_t{1} << 32) + k);
+        }
+        done.store(true);
+    });
+    size_t walks = 0;
+    while (!done.load() || walks < 2) {
+        std::unordered_map<uint64_t, int> seen = visits<decltype(set), uint64_t>(set, walks % 2 == 0 ? 0 : 3);
+        for (uint64_t k = 0; k < kStable; ++k) CHECK(seen[k] == 1);
+        for (const auto& entry : seen) {
+            CHECK(entry.second == 1);
+            CHECK(entry.first < kStable || entry.first >> 32 == 1);
+        }
+        ++walks;
+    }
+    writer.join();
+    CHECK(set.SizeExact() == kStable);
+}
+
+} // namespace
+
+int main() {
+    test_visits_each_key_once();
+    test_exceptions();
+    test_concurrent_writers();
+    std::puts("iteration_test: all passed");
+    return 0;
+}
@@ -0,0 +1,125 @@
+/************************************************************
+ * lock_free_test.cpp
+ *
+ * Tests for LockFreeVelocitySet: basic membership, the reserved
+ * key values, and lookup cost under insert/remove churn over
+ * many distinct keys, which leaves tombstones everywhere, and
+ * Clear() racing with readers.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/lock_free_test.cpp -o lock_free_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+void test_basic() {
+    velocity::LockFreeVelocitySet<uint64_t> set(1000);
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k);
+    set.Insert(~uint64_t{0}); // Reserved tombstone pattern
+    CHECK(set.GetApproximateSize() == 1001);
+    for (uint64_t k = 0; k < 1000; k += 2) set.Remove(k);
+    for (uint64_t k = 0; k < 1000; ++k) CHECK(set.Contains(k) == (k % 2 == 1));
+    CHECK(set.Contains(~uint64_t{0}));
+    set.Clear();
+    CHECK(set.GetApproximateSize() == 0);
+}
+
+// A sliding window of live keys over ever new keys fills the table with
+// tombstones. Misses must stay cheap instead of scanning the whole table.
+void test_churn() {
+    constexpr uint64_t kWindow = 1000;
+    velocity::LockFreeVelocitySet<uint64_t> set(4096); // 8192 slots, ~12% live
+    uint64_t next = 1;
+    for (; next <= kWindow; ++next) set.Insert(next);
+    for (int round = 0; round < 250000; ++round, ++next) {
+        set.Insert(next);
+        set.Remove(next - kWindow);
+    }
+    CHECK(set.GetApproximateSize() == kWindow);
+    for (uint64_t k = next - kWindow; k < next; ++k) CHECK(set.Contains(k));
+
+    constexpr int kLookups = 200000;
+    auto begin = Clock::now();
+    size_t found = 0;
+    for (int i = 0; i < kLookups; ++i) found += set.Contains(next + 1000000 + i);
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / kLookups;
+    CHECK(found == 0);
+    std::printf("churn: %.1f ns per missed Contains\n", ns);
+    CHECK(ns < 2000); // A full scan of 8192 slots costs several microseconds
+
+    // Churn on a large table must finish promptly as well
+    velocity::LockFreeVelocitySet<uint64_t> large(size_t{1} << 17);
+    begin = Clock::now();
+    for (uint64_t k = 1; k <= 1000000; ++k) {
+        large.Insert(k);
+        if (k > kWindow) large.Remove(k - kWindow);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    std::printf("churn: 1M inserts/removes on 262144 slots in %.2f s\n", seconds);
+    CHECK(seconds < 10);
+}
+
+void test_concurrent_churn() {
+    velocity::LockFreeVelocitySet<uint64_t> set(1 << 12);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, t]() {
+            uint64_t base = (t + 1) << 40;
+            for (uint64_t k = 0; k < 200000; ++k) {
+                set.Insert(base + k);
+                CHECK(set.Contains(base + k));
+                if (k >= 100) set.Remove(base + k - 100);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(set.GetApproximateSize() == 400);
+}
+
+// Clear() may race with readers only. Afterwards the set is reusable: keys
+// inserted again are found even at probe distances reached before the clear.
+void test_clear() {
+    constexpr uint64_t kFill = 7000; // Of 8192 slots: probe sequences get long
+    velocity::LockFreeVelocitySet<uint64_t> set(4096);
+    for (int round = 0; round < 20; ++round) {
+        for (uint64_t k = 1; k <= kFill; ++k) set.Insert(k);
+        std::atomic<bool> done{false};
+        std::thread reader([&set, &done]() {
+            while (!done.load()) {
+                for (uint64_t k = 1; k <= kFill; k += 97) (void)set.Contains(k);
+            }
+        });
+        set.Clear();
+        done.store(true);
+        reader.join();
+        CHECK(set.GetApproximateSize() == 0);
+        for (uint64_t k = 1; k <= kFill; ++k) CHECK(!set.Contains(k));
+    }
+    for (uint64_t k = 1; k <= kFill; ++k) set.Insert(k);
+    for (uint64_t k = 1; k <= kFill; ++k) CHECK(set.Contains(k));
+    CHECK(set.GetApproximateSize() == kFill);
+}
+
+} // namespace
+
+int main() {
+    test_basic();
+    test_churn();
+    test_concurrent_churn();
+    test_clear();
+    std::puts("lock_free_test: all passed");
+    return 0;
+}
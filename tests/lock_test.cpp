@@ -0,0 +1,227 @@
+/************************************************************
+ * lock_test.cpp
+ *
+ * Tests for the lock policies: mutual exclusion under
+ * contention, shared ownership where supported, sets built on
+ * each policy under concurrent updates, and lock striping.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/lock_test.cpp -o lock_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int kThreads = 4;
+
+// A plain counter only adds up if increments never overlap. Fair locks use
+// fewer rounds: on a host with fewer cores than threads each handoff may
+// wait for the next waiter to be scheduled.
+template <typename Lock>
+void check_exclusion(int rounds = 100000) {
+    Lock lock;
+    uint64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&lock, &counter, rounds]() {
+            for (int i = 0; i < rounds; ++i) {
+                lock.lock();
+                ++counter;
+                lock.unlock();
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(counter == uint64_t{kThreads} * rounds);
+}
+
+template <typename Lock>
+void check_set(uint64_t keys = 20000) {
+    velocity::VelocitySet<uint64_t, velocity::UnorderedSetStorage, velocity::IdentityHash, Lock> set(4, 1 << 20);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&set, t, keys]() {
+            for (uint64_t k = 0; k < keys; ++k) set.Insert(k * kThreads + t); // Four hot buckets
+            for (uint64_t k = 0; k < keys; k += 2) set.Remove(k * kThreads + t);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(set.SizeExact() == kThreads * keys / 2);
+    for (uint64_t k = 0; k < keys * kThreads; ++k) CHECK(set.Contains(k) == ((k / kThreads) % 2 == 1));
+}
+
+void test_spin_lock() {
+    check_exclusion<velocity::SpinLock>();
+    check_set<velocity::SpinLock>();
+}
+
+bool finishes_within(std::thread& thread, std::atomic<bool>& done, std::chrono::milliseconds limit) {
+    auto deadline = std::chrono::steady_clock::now() + limit;
+    while (!done.load() && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+    bool finished = done.load();
+    if (finished) thread.join();
+    return finished;
+}
+
+void test_rw_spin_lock() {
+    check_exclusion<velocity::RWSpinLock>();
+    check_set<velocity::RWSpinLock>();
+
+    velocity::RWSpinLock lock;
+    lock.lock_shared();
+    std::atomic<bool> reader_done{false};
+    std::thread reader([&]() {
+        lock.lock_shared(); // Readers share
+        lock.unlock_shared();
+        reader_done.store(true);
+    });
+    CHECK(finishes_within(reader, reader_done, std::chrono::seconds(10)));
+
+    std::atomic<bool> writer_done{false};
+    std::thread writer([&]() {
+        lock.lock(); // Waits for the reader below
+        lock.unlock();
+        writer_done.store(true);
+    });
+    CHECK(!finishes_within(writer, writer_done, std::chrono::milliseconds(50)));
+    lock.unlock_shared();
+    CHECK(finishes_within(writer, writer_done, std::chrono::seconds(10)));
+}
+
+// Holders that sleep make waiters exhaust their spin budget and park; every
+// unlock must still hand the lock on.
+void test_futex_lock() {
+    check_exclusion<velocity::FutexLock>();
+    check_set<velocity::FutexLock>();
+
+    velocity::FutexLock lock;
+    uint64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&lock, &counter]() {
+            for (int i = 0; i < 20; ++i) {
+                lock.lock();
+                ++counter;
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                lock.unlock();
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(counter == 8 * 20);
+}
+
+void test_backoff_spin_lock() {
+    check_exclusion<velocity::BackoffSpinLock<>>();
+    check_exclusion<velocity::BackoffSpinLock<64>>();
+    check_set<velocity::BackoffSpinLock<>>();
+
+    velocity::BackoffSpinLock<> lock;
+    CHECK(lock.try_lock());
+    CHECK(!lock.try_lock());
+    lock.unlock();
+    CHECK(lock.try_lock());
+    lock.unlock();
+}
+
+void test_ticket_lock() {
+    check_exclusion<velocity::TicketLock>(5000);
+    check_set<velocity::TicketLock>(2000);
+}
+
+// One thread may hold several MCS locks at once, released in any order,
+// as Replace does with two buckets.
+void test_mcs_lock() {
+    check_exclusion<velocity::McsLock>(5000);
+    check_set<velocity::McsLock>(2000);
+
+    velocity::McsLock locks[velocity::McsLock::kMaxHeldPerThread];
+    uint64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&locks, &counter]() {
+            for (int i = 0; i < 500; ++i) {
+                for (velocity::McsLock& lock : locks) lock.lock(); // Same order everywhere
+                ++counter;
+                for (size_t j = 0; j < velocity::McsLock::kMaxHeldPerThread; j += 2) locks[j].unlock();
+                for (size_t j = 1; j < velocity::McsLock::kMaxHeldPerThread; j += 2) locks[j].unlock();
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(counter == uint64_t{kThreads} * 500);
+
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage, velocity::Murmur3Hash, velocity::McsLock> set(16);
+    for (uint64_t k = 0; k < 200; ++k) set.Insert(k);
+    std::vector<std::thread> replacers;
+    for (uint64_t t = 0; t < kThreads; ++t) {
+        replacers.emplace_back([&set, t]() {
+            for (uint64_t k = t; k < 200; k += kThreads) CHECK(set.Replace(k, k + 1000000));
+        });
+    }
+    for (std::thread& thread : replacers) thread.join();
+    CHECK(set.SizeExact() == 200);
+    for (uint64_t k = 0; k < 200; ++k) CHECK(set.Contains(k + 1000000) && !set.Contains(k));
+}
+
+// With one stripe every bucket shares a lock: operations locking two
+// buckets (Replace, splits, merges) must not deadlock on themselves.
+void test_striping() {
+    using Set = velocity::VelocitySet<uint64_t>;
+    CHECK(Set(64, 0, {}, 8).GetLockCount() == 8);
+    CHECK(Set(64).GetLockCount() == 64); // One lock per bucket
+    CHECK(Set(64, 0, {}, Set::kDefaultLockStripes).GetLockCount() >= 1);
+    bool rejected = false;
+    try {
+        Set bad(64, 0, {}, 6);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    Set set(2, 4, {}, 1);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&set, t]() {
+            uint64_t base = t << 32;
+            for (uint64_t k = 0; k < 5000; ++k) set.Insert(base + k); // Splits
+            for (uint64_t k = 0; k < 5000; ++k) CHECK(set.Replace(base + k, base + k + 100000));
+            for (uint64_t k = 0; k < 5000; k += 2) set.Remove(base + k + 100000); // Merges
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(set.GetLockCount() == 1);
+    CHECK(set.GetBucketCount() > 2);
+    CHECK(set.SizeExact() == kThreads * 2500);
+    for (uint64_t t = 0; t < kThreads; ++t) {
+        for (uint64_t k = 0; k < 5000; ++k) {
+            CHECK(!set.Contains((t << 32) + k));
+            CHECK(set.Contains((t << 32) + k + 100000) == (k % 2 == 1));
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_spin_lock();
+    test_rw_spin_lock();
+    test_futex_lock();
+    test_backoff_spin_lock();
+    test_ticket_lock();
+    test_mcs_lock();
+    test_striping();
+    std::puts("lock_test: all passed");
+    return 0;
+}
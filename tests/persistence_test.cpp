@@ -0,0 +1,163 @@
+/************************************************************
+ * persistence_test.cpp
+ *
+ * Tests for SaveTo/LoadFrom: round trips through the bucket
+ * build and InsertBatch paths, bool keys, rejected files,
+ * concurrent saves to the same path, and the saved file's
+ * permissions.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/persistence_test.cpp -o persistence_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace
+{
+
+template <typename Set>
+std::set<int64_t> keys_of(const Set& set) {
+    std::set<int64_t> keys;
+    set.ForEach([&](auto key) { keys.insert(static_cast<int64_t>(key)); });
+    return keys;
+}
+
+// make(0) builds the saved set; make(1) a set with another layout, which
+// loads through InsertBatch. Layout 2 is make(0) holding a key already.
+template <typename Set, typename Make>
+void check_round_trip(const TempDir& dir, Make make, uint64_t range) {
+    using Key = typename std::decay<decltype(make(0)->Snapshot().Keys()[0])>::type;
+    std::mt19937_64 rng(3);
+    std::unique_ptr<Set> saved = make(0);
+    for (int i = 0; i < 100000; ++i) saved->Insert(static_cast<Key>(rng() % range));
+    std::set<int64_t> expected = keys_of(*saved);
+    saved->SaveTo(dir.File("set.bin"));
+    for (int layout = 0; layout < 3; ++layout) {
+        std::unique_ptr<Set> loaded = make(layout == 1);
+        Key present = static_cast<Key>(*expected.begin());
+        if (layout == 2) loaded->Insert(present);
+        CHECK(loaded->LoadFrom(dir.File("set.bin"), 4) == expected.size() - (layout == 2));
+        CHECK(keys_of(*loaded) == expected);
+        CHECK(loaded->SizeExact() == expected.size());
+    }
+}
+
+void test_round_trip(const TempDir& dir) {
+    using Set = velocity::VelocitySet<uint64_t>;
+    check_round_trip<Set>(dir, [](int layout) { return std::make_unique<Set>(layout ? 8 : 16); }, uint64_t{1} << 40);
+    using FlatSet = velocity::VelocitySet<int32_t, velocity::FlatStorage, velocity::SeededHash>;
+    check_round_trip<FlatSet>(dir, [](int layout) {
+        return std::make_unique<FlatSet>(16, 0, layout ? velocity::SeededHash(9, 9) : velocity::SeededHash(1, 2));
+    }, uint64_t{1} << 31);
+    using SmallSet = velocity::VelocitySet<int16_t>;
+    check_round_trip<SmallSet>(dir, [](int) { return std::make_unique<SmallSet>(); }, 65536);
+}
+
+void test_bool_keys(const TempDir& dir) {
+    using Set = velocity::VelocitySet<bool>;
+    Set saved;
+    saved.Insert(true);
+    saved.SaveTo(dir.File("bool.bin"));
+    Set loaded;
+    CHECK(loaded.LoadFrom(dir.File("bool.bin")) == 1);
+    CHECK(loaded.Contains(true) && !loaded.Contains(false));
+    saved.Insert(false);
+    saved.SaveTo(dir.File("bool.bin"));
+    Set other_layout(64);
+    CHECK(other_layout.LoadFrom(dir.File("bool.bin")) == 2);
+    CHECK(other_layout.Size() == 2);
+}
+
+void test_rejected_files(const TempDir& dir) {
+    velocity::VelocitySet<uint64_t> saved;
+    saved.Insert(1);
+    saved.SaveTo(dir.File("wide.bin"));
+    bool rejected = false;
+    try {
+        velocity::VelocitySet<uint32_t> narrow;
+        narrow.LoadFrom(dir.File("wide.bin"));
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    rejected = false;
+    try {
+        saved.SaveTo(dir.File("missing/set.bin"));
+    } catch (const std::system_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+// Every save writes its own temporary file: the result is one complete
+// save, and no temporary is left behind.
+void test_concurrent_saves(const TempDir& dir) {
+    using Set = velocity::VelocitySet<uint64_t>;
+    constexpr int kThreads = 4;
+    std::vector<std::unique_ptr<Set>> sets;
+    for (int t = 0; t < kThreads; ++t) {
+        sets.push_back(std::make_unique<Set>(64));
+        for (uint64_t k = 0; k < 50000; ++k) sets[t]->Insert(k * kThreads + t);
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 10; ++i) sets[t]->SaveTo(dir.File("shared.bin"));
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    Set loaded;
+    CHECK(loaded.LoadFrom(dir.File("shared.bin")) == 50000);
+    std::set<int64_t> keys = keys_of(loaded);
+    bool matches_one = false;
+    for (const std::unique_ptr<Set>& set : sets) matches_one |= keys == keys_of(*set);
+    CHECK(matches_one);
+    for (const std::string& name : dir.Names()) CHECK(name.find(".tmp") == std::string::npos);
+}
+
+mode_t mode_of(const std::string& path) {
+    struct stat info;
+    CHECK(::stat(path.c_str(), &info) == 0);
+    return info.st_mode & 0777;
+}
+
+// A new file gets the permissions the umask allows (077, set by main); a
+// save over an existing file keeps that file's permissions.
+void test_file_mode(const TempDir& dir) {
+    velocity::VelocitySet<uint64_t> set;
+    set.Insert(1);
+    set.SaveTo(dir.File("mode.bin"));
+    CHECK(mode_of(dir.File("mode.bin")) == 0600);
+    CHECK(::chmod(dir.File("mode.bin").c_str(), 0640) == 0);
+    set.SaveTo(dir.File("mode.bin"));
+    CHECK(mode_of(dir.File("mode.bin")) == 0640);
+}
+
+} // namespace
+
+int main() {
+    ::umask(077); // Before the first save: the library reads the umask once
+    TempDir dir;
+    test_round_trip(dir);
+    test_bool_keys(dir);
+    test_rejected_files(dir);
+    test_concurrent_saves(dir);
+    test_file_mode(dir);
+    std::puts("persistence_test: all passed");
+    return 0;
+}
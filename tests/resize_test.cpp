@@ -0,0 +1,105 @@
+/************************************************************
+ * resize_test.cpp
+ *
+ * Tests for online resizing: the bucket count follows the key
+ * count through linear-hashing splits and merges, and readers
+ * running meanwhile always find keys that stay in the set.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/resize_test.cpp -o resize_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+template <typename Set>
+void check_grow_and_shrink(Set& set) {
+    constexpr uint64_t kKeys = 100000;
+    size_t initial = set.GetBucketCount();
+    for (uint64_t k = 0; k < kKeys; ++k) set.Insert(k * 7);
+    CHECK(set.Size() == kKeys);
+    CHECK(set.GetBucketCount() >= kKeys / 8); // Average load at most 8
+    for (uint64_t k = 0; k < kKeys; ++k) CHECK(set.Contains(k * 7));
+    CHECK(!set.Contains(3));
+
+    for (uint64_t k = 0; k < kKeys; ++k) set.Remove(k * 7);
+    CHECK(set.Size() == 0);
+    CHECK(set.GetBucketCount() == initial); // Merged back to the initial table
+    for (uint64_t k = 0; k < kKeys; k += 101) CHECK(!set.Contains(k * 7));
+
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k);
+    for (uint64_t k = 0; k < 1000; ++k) CHECK(set.Contains(k));
+}
+
+void test_grow_and_shrink() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_grow_and_shrink(set);
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage> flat(4, 8);
+    check_grow_and_shrink(flat);
+    velocity::VelocitySet<uint64_t, velocity::UnorderedSetStorage, velocity::Murmur3Hash> striped(4, 8, {}, 2);
+    check_grow_and_shrink(striped);
+    CHECK(striped.GetLockCount() == 2);
+}
+
+// Writers insert and remove a block of keys over and over, so the table
+// keeps splitting and merging. Keys below kStable never leave the set and
+// keys at or above kNever are never inserted.
+template <typename Set>
+void check_concurrent_readers() {
+    constexpr uint64_t kStable = 2000;
+    constexpr uint64_t kNever = uint64_t{1} << 40;
+    Set set(2, 4);
+    for (uint64_t k = 0; k < kStable; ++k) set.Insert(k);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (uint64_t t = 0; t < 2; ++t) {
+        writers.emplace_back([&set, t]() {
+            uint64_t base = (t + 1) << 32;
+            for (int round = 0; round < 20; ++round) {
+                for (uint64_t k = 0; k < 20000; ++k) set.Insert(base + k);
+                for (uint64_t k = 0; k < 20000; ++k) set.Remove(base + k);
+            }
+        });
+    }
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t) {
+        readers.emplace_back([&set, &done]() {
+            while (!done.load()) {
+                for (uint64_t k = 0; k < kStable; ++k) {
+                    CHECK(set.Contains(k));
+                    CHECK(!set.Contains(kNever + k));
+                }
+            }
+        });
+    }
+    for (std::thread& writer : writers) writer.join();
+    done.store(true);
+    for (std::thread& reader : readers) reader.join();
+    CHECK(set.Size() == kStable);
+    CHECK(set.SizeExact() == kStable);
+}
+
+void test_concurrent_readers() {
+    check_concurrent_readers<velocity::VelocitySet<uint64_t>>();
+    check_concurrent_readers<velocity::VelocitySet<uint64_t, velocity::FlatStorage>>(); // Lock-free reads
+    check_concurrent_readers<velocity::VelocitySet<uint64_t, velocity::SwissStorage, velocity::Murmur3Hash,
+                                                   velocity::RWSpinLock>>();
+}
+
+} // namespace
+
+int main() {
+    test_grow_and_shrink();
+    test_concurrent_readers();
+    std::puts("resize_test: all passed");
+    return 0;
+}
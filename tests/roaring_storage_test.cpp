@@ -0,0 +1,239 @@
+/************************************************************
+ * roaring_storage_test.cpp
+ *
+ * Tests for RoaringStorage: contents against std::set while
+ * chunks convert between array, bitmap and run containers,
+ * the memory each container kind takes, chunk edges and wide
+ * or signed keys, and use in a VelocitySet with ChunkHash.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/roaring_storage_test.cpp -o roaring_storage_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Live heap bytes, to tell the container kinds apart from outside
+std::atomic<int64_t> g_heap_bytes{0};
+
+void* operator new(size_t size) {
+    void* block = std::malloc(size + 16);
+    if (block == nullptr) throw std::bad_alloc();
+    *static_cast<size_t*>(block) = size;
+    g_heap_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    return static_cast<char*>(block) + 16;
+}
+
+void operator delete(void* p) noexcept {
+    if (p == nullptr) return;
+    void* block = static_cast<char*>(p) - 16;
+    g_heap_bytes.fetch_sub(static_cast<int64_t>(*static_cast<size_t*>(block)), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+namespace
+{
+
+/** @brief Allocates with malloc, so expected contents do not count as heap bytes. */
+template <typename T>
+struct UntrackedAllocator {
+    using value_type = T;
+    UntrackedAllocator() = default;
+    template <typename U>
+    UntrackedAllocator(const UntrackedAllocator<U>&) noexcept {}
+    T* allocate(size_t n) {
+        void* block = std::malloc(n * sizeof(T));
+        if (block == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(block);
+    }
+    void deallocate(T* p, size_t) noexcept { std::free(p); }
+    template <typename U>
+    bool operator==(const UntrackedAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const UntrackedAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using KeySet = std::set<T, std::less<T>, UntrackedAllocator<T>>;
+
+/** @brief A storage and the keys it should hold, updated together. */
+template <typename T>
+struct Checked {
+    velocity::RoaringStorage<T> storage;
+    KeySet<T> expected;
+    int64_t baseline = g_heap_bytes.load();
+
+    void insert(T key) { CHECK(storage.insert(key) == expected.insert(key).second); }
+    void erase(T key) { CHECK(storage.erase(key) == (expected.erase(key) == 1)); }
+
+    /** @brief Heap bytes the storage holds now. */
+    int64_t bytes() const { return g_heap_bytes.load() - baseline; }
+
+    void check() const {
+        CHECK(storage.size() == expected.size());
+        KeySet<T> seen;
+        T previous{};
+        bool first = true;
+        storage.for_each([&](const T& key) {
+            CHECK(seen.insert(key).second);
+            if (!first && static_cast<uint64_t>(key) >> 16 == static_cast<uint64_t>(previous) >> 16) {
+                CHECK(key > previous); // Increasing within a chunk
+            }
+            previous = key;
+            first = false;
+        });
+        CHECK(seen == expected);
+        for (T key : expected) CHECK(storage.contains(key));
+    }
+};
+
+// One chunk goes through every container kind; the memory it holds tells
+// which kind it is in.
+void test_conversions() {
+    Checked<uint32_t> chunk;
+    for (uint32_t k = 0; k < 1000; ++k) chunk.insert(5u << 16 | k * 61); // Scattered: array
+    chunk.check();
+    CHECK(chunk.bytes() >= 2000 && chunk.bytes() < 8192);
+
+    for (uint32_t k = 0; k < 30000; ++k) chunk.insert(5u << 16 | k * 2); // Crowded: bitmap
+    chunk.check();
+    CHECK(chunk.bytes() >= 8192 && chunk.bytes() < 12000);
+
+    for (uint32_t k = 0; k < 65536; ++k) chunk.insert(5u << 16 | k); // Full: one run
+    chunk.check();
+    CHECK(chunk.bytes() < 1024);
+
+    for (uint32_t k = 0; k < 65536; k += 2) chunk.erase(5u << 16 | k); // Every other key: bitmap again
+    chunk.check();
+    CHECK(chunk.bytes() >= 8192 && chunk.bytes() < 12000);
+
+    for (uint32_t k = 1; k < 65536; k += 2) {
+        if (k % 64 != 1) chunk.erase(5u << 16 | k); // 1024 keys left: array
+    }
+    chunk.check();
+    CHECK(chunk.bytes() >= 2048 && chunk.bytes() < 8192);
+
+    for (uint32_t k = 0; k < 20000; ++k) chunk.insert(5u << 16 | k); // A long run beside scattered keys
+    chunk.check();
+    for (uint32_t k = 1; k < 65536; k += 64) chunk.erase(5u << 16 | k);
+    chunk.check();
+    for (uint32_t k = 0; k < 20000; ++k) chunk.erase(5u << 16 | k);
+    chunk.check();
+    CHECK(chunk.storage.size() == 0);
+    CHECK(chunk.bytes() < 256); // Empty chunks are dropped; the chunk list keeps its capacity
+}
+
+// Random updates over a few chunks, with runs, gaps and crowding, compared
+// with std::set.
+template <typename T>
+void check_random(uint64_t first_chunk) {
+    Checked<T> chunks;
+    std::mt19937_64 rng(23);
+    for (int op = 0; op < 400000; ++op) {
+        uint64_t chunk = first_chunk + rng() % 3;
+        uint64_t low = rng() % 8 == 0 ? rng() % 65536 : 30000 + rng() % 6000; // Mostly one busy stretch
+        T key = static_cast<T>(chunk << 16 | low);
+        if (rng() % 5 < 2) {
+            chunks.erase(key);
+        } else {
+            chunks.insert(key);
+        }
+        if (op % 100000 == 0) chunks.check();
+    }
+    chunks.check();
+    chunks.storage.clear();
+    chunks.expected.clear();
+    chunks.check();
+}
+
+void test_random() {
+    check_random<uint32_t>(100);
+    check_random<uint64_t>(uint64_t{1} << 40);
+    check_random<int32_t>(0xFFFE); // Chunks of negative keys, and chunk 0x10000 wraps to 0
+    check_random<int64_t>((~uint64_t{0} >> 16) - 1);
+}
+
+// Keys at the edges of chunks and of the type.
+void test_edges() {
+    Checked<uint32_t> keys;
+    for (uint32_t key : {0u, 65535u, 65536u, 131071u, 0xFFFF0000u, 0xFFFFFFFFu}) keys.insert(key);
+    keys.check();
+    CHECK(!keys.storage.contains(65537u) && !keys.storage.contains(0xFFFEFFFFu));
+    keys.erase(65535u);
+    keys.erase(65536u);
+    keys.check();
+
+    Checked<int64_t> wide;
+    for (int64_t key : {std::numeric_limits<int64_t>::min(), int64_t{-1}, int64_t{0},
+                        std::numeric_limits<int64_t>::max(), int64_t{-65536}, int64_t{65536}}) {
+        wide.insert(key);
+    }
+    wide.check();
+}
+
+void test_moves() {
+    Checked<uint32_t> source;
+    for (uint32_t k = 0; k < 70000; ++k) source.insert(k * 3);
+    velocity::RoaringStorage<uint32_t> moved(std::move(source.storage));
+    CHECK(source.storage.size() == 0 && moved.size() == source.expected.size());
+    velocity::RoaringStorage<uint32_t> target;
+    target.insert(7);
+    target = std::move(moved);
+    CHECK(target.size() == source.expected.size());
+    for (uint32_t key : source.expected) CHECK(target.contains(key));
+    CHECK(!target.contains(7));
+}
+
+// With ChunkHash each chunk lives in one bucket; threads fill their own
+// chunks with runs, crowds and scattered keys at once.
+void test_in_set() {
+    velocity::VelocitySet<uint32_t, velocity::RoaringStorage, velocity::ChunkHash> set;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, t]() {
+            for (uint32_t c = 0; c < 8; ++c) {
+                uint32_t base = (t * 8 + c) << 16;
+                for (uint32_t k = 0; k < 65536; k += 1 + c % 3) set.Insert(base | k); // Run or crowd
+                for (uint32_t k = 0; k < 65536; k += 3) set.Remove(base | k);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    size_t expected = 0;
+    for (uint32_t t = 0; t < 4; ++t) {
+        for (uint32_t c = 0; c < 8; ++c) {
+            uint32_t base = (t * 8 + c) << 16;
+            for (uint32_t k = 0; k < 65536; ++k) {
+                bool present = k % (1 + c % 3) == 0 && k % 3 != 0;
+                CHECK(set.Contains(base | k) == present);
+                expected += present;
+            }
+        }
+    }
+    CHECK(set.SizeExact() == expected);
+}
+
+} // namespace
+
+int main() {
+    test_conversions();
+    test_random();
+    test_edges();
+    test_moves();
+    test_in_set();
+    std::puts("roaring_storage_test: all passed");
+    return 0;
+}
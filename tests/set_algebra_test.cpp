@@ -0,0 +1,190 @@
+/************************************************************
+ * set_algebra_test.cpp
+ *
+ * Tests for UnionWith, IntersectWith, Subtract and Intersect
+ * against std::set, for sets sharing a layout (bucket-parallel
+ * path) and sets that do not (batch path), for bool keys, and
+ * for a union cut short by a failing storage.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/set_algebra_test.cpp -o set_algebra_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include <thread>
+
+namespace
+{
+
+template <typename Set>
+std::set<uint64_t> keys_of(const Set& set) {
+    std::set<uint64_t> keys;
+    set.ForEach([&](auto key) { keys.insert(key); });
+    return keys;
+}
+
+// make(layout) builds an empty set; sets built with different layouts do
+// not share their bucket layout.
+template <typename Set, typename Make>
+void check_algebra(Make make, uint64_t range) {
+    std::mt19937_64 rng(7);
+    for (int layout = 0; layout < 2; ++layout) {
+        std::unique_ptr<Set> a = make(0);
+        std::unique_ptr<Set> b = make(layout);
+        std::set<uint64_t> in_a, in_b;
+        for (int i = 0; i < 20000; ++i) {
+            uint64_t key = rng() % range;
+            a->Insert(key);
+            in_a.insert(key);
+            key = rng() % range;
+            b->Insert(key);
+            in_b.insert(key);
+        }
+        std::set<uint64_t> both, only_a, either = in_a;
+        either.insert(in_b.begin(), in_b.end());
+        for (uint64_t key : in_a) (in_b.count(key) ? both : only_a).insert(key);
+
+        std::unique_ptr<Set> intersection = Set::Intersect(*a, *b, 4);
+        CHECK(keys_of(*intersection) == both);
+        CHECK(intersection->Size() == both.size());
+
+        std::unique_ptr<Set> set = make(0);
+        for (uint64_t key : in_a) set->Insert(key);
+        CHECK(set->UnionWith(*b, 4) == either.size() - in_a.size());
+        CHECK(keys_of(*set) == either);
+        CHECK(set->SizeExact() == either.size());
+
+        set = make(0);
+        for (uint64_t key : in_a) set->Insert(key);
+        CHECK(set->IntersectWith(*b, 3) == in_a.size() - both.size());
+        CHECK(keys_of(*set) == both);
+
+        set = make(0);
+        for (uint64_t key : in_a) set->Insert(key);
+        CHECK(set->Subtract(*b) == both.size());
+        CHECK(keys_of(*set) == only_a);
+        CHECK(set->Subtract(*set) == only_a.size());
+        CHECK(set->Size() == 0);
+    }
+}
+
+void test_algebra() {
+    using Set = velocity::VelocitySet<uint64_t>;
+    check_algebra<Set>([](int layout) { return std::make_unique<Set>(layout ? 8 : 64, 4); }, 100000);
+    using FlatSet = velocity::VelocitySet<uint32_t, velocity::FlatStorage, velocity::SeededHash>;
+    check_algebra<FlatSet>([](int layout) {
+        return std::make_unique<FlatSet>(64, 0, layout ? velocity::SeededHash(1, 2) : velocity::SeededHash(3, 4));
+    }, 50000);
+    using SmallSet = velocity::VelocitySet<uint16_t>;
+    check_algebra<SmallSet>([](int) { return std::make_unique<SmallSet>(); }, 65536);
+}
+
+// bool keys live in buckets; the algebra must build for them too.
+void test_bool_keys() {
+    using Set = velocity::VelocitySet<bool>;
+    Set a(4), b(4), other_layout(16);
+    a.Insert(true);
+    a.Insert(false);
+    b.Insert(true);
+    other_layout.Insert(false);
+
+    CHECK(keys_of(*Set::Intersect(a, b)) == std::set<uint64_t>{1});
+    CHECK(keys_of(*Set::Intersect(a, other_layout)) == std::set<uint64_t>{0});
+    CHECK(keys_of(*Set::Intersect(a, a)) == (std::set<uint64_t>{0, 1}));
+
+    Set c(4);
+    CHECK(c.UnionWith(b) == 1);
+    CHECK(c.UnionWith(other_layout) == 1);
+    CHECK(c.Size() == 2);
+    CHECK(c.IntersectWith(other_layout) == 1);
+    CHECK(keys_of(c) == std::set<uint64_t>{0});
+    CHECK(a.Subtract(other_layout) == 1);
+    CHECK(keys_of(a) == std::set<uint64_t>{1});
+    CHECK(a.Subtract(b) == 1);
+    CHECK(a.Size() == 0);
+}
+
+// Operations running in opposite directions must not deadlock.
+void test_concurrent() {
+    velocity::VelocitySet<uint64_t> a(64), b(64);
+    for (uint64_t i = 0; i < 100000; ++i) {
+        a.Insert(i * 2);
+        b.Insert(i * 3);
+    }
+    std::thread forward([&] { for (int i = 0; i < 20; ++i) a.UnionWith(b, 2); });
+    std::thread backward([&] { for (int i = 0; i < 20; ++i) b.UnionWith(a, 2); });
+    forward.join();
+    backward.join();
+    b.UnionWith(a);
+    CHECK(a.SizeExact() == b.SizeExact());
+    CHECK(keys_of(a) == keys_of(b));
+}
+
+// FlatStorage that runs out of memory once g_insert_budget reaches zero
+// (negative: never), and counts lookups that had to take the bucket lock.
+long g_insert_budget = -1;
+size_t g_locked_lookups = 0;
+
+template <typename T>
+class FailingStorage : public velocity::FlatStorage<T> {
+public:
+    bool insert(const T& item) {
+        if (g_insert_budget == 0) throw std::bad_alloc();
+        if (g_insert_budget > 0) --g_insert_budget;
+        return velocity::FlatStorage<T>::insert(item);
+    }
+    bool contains(const T& item) const {
+        ++g_locked_lookups;
+        return velocity::FlatStorage<T>::contains(item);
+    }
+};
+
+// A union failing halfway through a bucket must close the bucket's write
+// section (lock-free lookups keep working instead of falling back to the
+// lock) and count the keys it did add.
+void test_failed_union() {
+    using Set = velocity::VelocitySet<uint64_t, FailingStorage>;
+    Set a(16, 1 << 20), b(16, 1 << 20); // Shared layout, never resized
+    for (uint64_t k = 0; k < 2000; ++k) {
+        a.Insert(k * 2);
+        b.Insert(k * 2 + 1);
+    }
+    g_insert_budget = 700; // Runs out inside a bucket
+    bool failed = false;
+    try {
+        a.UnionWith(b);
+    } catch (const std::bad_alloc&) {
+        failed = true;
+    }
+    g_insert_budget = -1;
+    CHECK(failed);
+    std::set<uint64_t> keys = keys_of(a);
+    CHECK(keys.size() == 2700);
+    CHECK(a.Size() == keys.size());
+    CHECK(a.SizeExact() == keys.size());
+    g_locked_lookups = 0;
+    for (uint64_t k = 0; k < 4000; ++k) CHECK(a.Contains(k) == (keys.count(k) == 1));
+    CHECK(g_locked_lookups == 0);
+
+    CHECK(a.UnionWith(b) == 1300);
+    CHECK(a.Size() == 4000);
+}
+
+} // namespace
+
+int main() {
+    test_algebra();
+    test_bool_keys();
+    test_concurrent();
+    test_failed_union();
+    std::puts("set_algebra_test: all passed");
+    return 0;
+}
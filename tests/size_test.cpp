@@ -0,0 +1,155 @@
+/************************************************************
+ * size_test.cpp
+ *
+ * Tests for the maintained element count: Size() matches the
+ * contents after every kind of update, counts only real
+ * changes, takes no lock, and stays close to the truth while
+ * writers run. SizeExact() is exact once they stop.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/size_test.cpp -o size_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::atomic<uint64_t> g_locks{0};
+
+/** @brief A SpinLock that counts acquisitions. */
+class CountingLock {
+public:
+    void lock() noexcept {
+        g_locks.fetch_add(1, std::memory_order_relaxed);
+        lock_.lock();
+    }
+    bool try_lock() noexcept {
+        g_locks.fetch_add(1, std::memory_order_relaxed);
+        return lock_.try_lock();
+    }
+    void unlock() noexcept { lock_.unlock(); }
+
+private:
+    velocity::SpinLock lock_;
+};
+
+// Every update path keeps Size() equal to the number of keys present.
+template <typename Set>
+void check_updates(Set& set) {
+    auto present = [&set]() {
+        size_t count = 0;
+        set.ForEach([&count](uint64_t) { ++count; });
+        return count;
+    };
+    for (uint64_t k = 0; k < 10000; ++k) set.Insert(k * 5);
+    for (uint64_t k = 0; k < 10000; ++k) set.Insert(k * 5); // Repeats change nothing
+    CHECK(set.Size() == 10000);
+    for (uint64_t k = 0; k < 10000; k += 2) set.Remove(k * 5);
+    set.Remove(1); // Absent
+    CHECK(set.Size() == 5000 && present() == 5000);
+
+    std::vector<uint64_t> batch;
+    for (uint64_t k = 0; k < 20000; ++k) batch.push_back(k * 5 % 70000);
+    set.InsertBatch(batch.data(), batch.size());
+    CHECK(set.Size() == present());
+    set.RemoveBatch(batch.data(), batch.size() / 2);
+    CHECK(set.Size() == present());
+
+    uint64_t kept = 0;
+    set.ForEach([&kept](uint64_t key) { kept = key; });
+    CHECK(set.Replace(kept, kept + 1)); // Into an absent key
+    CHECK(set.Size() == present());
+    CHECK(set.Replace(kept + 1, kept + 1 + 5 * 1000003)); // Likely another bucket
+    CHECK(set.Size() == present());
+    CHECK(set.SizeExact() == set.Size());
+    CHECK(set.GetApproximateSize() == set.Size());
+}
+
+void test_updates() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_updates(set);
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage, velocity::Murmur3Hash> flat(4, 8);
+    check_updates(flat);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::SwissStorage>;
+    DenseSet dense(DenseSet::DenseRange{0, 30000});
+    check_updates(dense);
+}
+
+// Set algebra and LoadFrom add their changes to the count too.
+void test_bulk() {
+    using Set = velocity::VelocitySet<uint64_t>;
+    Set a(16), b(16), c(8); // c has another layout
+    for (uint64_t k = 0; k < 6000; ++k) a.Insert(k);
+    for (uint64_t k = 3000; k < 9000; ++k) b.Insert(k);
+    for (uint64_t k = 0; k < 9000; k += 3) c.Insert(k);
+    CHECK(a.UnionWith(b) == 3000 && a.Size() == 9000);
+    CHECK(a.Subtract(c) == 3000 && a.Size() == 6000);
+    CHECK(a.IntersectWith(b) == 2000 && a.Size() == 4000);
+    CHECK(a.SizeExact() == 4000);
+
+    TempDir dir;
+    std::string path = dir.File("size.vset");
+    a.SaveTo(path);
+    Set loaded;
+    CHECK(loaded.LoadFrom(path) == 4000);
+    CHECK(loaded.Size() == 4000 && loaded.SizeExact() == 4000);
+    CHECK(loaded.LoadFrom(path) == 0); // Already present
+    CHECK(loaded.Size() == 4000);
+}
+
+// Size() reads counters only; SizeExact() is the opt-in that locks buckets.
+void test_size_takes_no_lock() {
+    velocity::VelocitySet<uint64_t, velocity::UnorderedSetStorage, velocity::IdentityHash, CountingLock> set(64);
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k);
+    uint64_t before = g_locks.load();
+    for (int i = 0; i < 100; ++i) CHECK(set.Size() == 1000);
+    CHECK(set.GetApproximateSize() == 1000);
+    CHECK(g_locks.load() == before);
+    CHECK(set.SizeExact() == 1000);
+    CHECK(g_locks.load() > before);
+}
+
+// Under concurrent updates Size() is off by at most the updates in flight.
+// Each writer keeps at most two of its keys present at once.
+void test_concurrent() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    for (uint64_t k = 0; k < 1000; ++k) set.Insert(k);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (uint64_t t = 1; t <= 3; ++t) {
+        writers.emplace_back([&set, &done, t]() {
+            for (uint64_t k = 0; !done.load(); ++k) {
+                set.Insert((t << 32) + k);
+                set.Remove((t << 32) + k);
+            }
+        });
+    }
+    for (int i = 0; i < 100000; ++i) {
+        size_t size = set.Size();
+        CHECK(size >= 1000 - 3 && size <= 1000 + 6);
+    }
+    done.store(true);
+    for (std::thread& writer : writers) writer.join();
+    CHECK(set.Size() == 1000);
+    CHECK(set.SizeExact() == 1000);
+}
+
+} // namespace
+
+int main() {
+    test_updates();
+    test_bulk();
+    test_size_takes_no_lock();
+    test_concurrent();
+    std::puts("size_test: all passed");
+    return 0;
+}
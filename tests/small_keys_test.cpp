@@ -0,0 +1,186 @@
+/************************************************************
+ * small_keys_test.cpp
+ *
+ * Tests for the bitmap used by 8- and 16-bit key types: every
+ * key of the type's range, signed and unsigned, against
+ * std::set; Replace within and across 64-key words; batches
+ * and iteration; and concurrent updates without locks.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/small_keys_test.cpp -o small_keys_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::atomic<uint64_t> g_locks{0};
+
+/** @brief A SpinLock that counts acquisitions. */
+class CountingLock {
+public:
+    void lock() noexcept {
+        g_locks.fetch_add(1, std::memory_order_relaxed);
+        lock_.lock();
+    }
+    bool try_lock() noexcept {
+        g_locks.fetch_add(1, std::memory_order_relaxed);
+        return lock_.try_lock();
+    }
+    void unlock() noexcept { lock_.unlock(); }
+
+private:
+    velocity::SpinLock lock_;
+};
+
+template <typename Key>
+std::vector<Key> all_keys() {
+    std::vector<Key> keys;
+    for (int64_t k = std::numeric_limits<Key>::min(); k <= std::numeric_limits<Key>::max(); ++k) {
+        keys.push_back(static_cast<Key>(k));
+    }
+    return keys;
+}
+
+// Random updates over the whole range, the extremes included, compared
+// with std::set.
+template <typename Key>
+void check_against_set() {
+    velocity::VelocitySet<Key> set;
+    std::set<Key> expected;
+    std::vector<Key> keys = all_keys<Key>();
+    std::mt19937_64 rng(9);
+    for (int op = 0; op < 200000; ++op) {
+        Key key = keys[rng() % keys.size()];
+        Key other = keys[rng() % keys.size()];
+        switch (rng() % 4) {
+        case 0:
+            CHECK(set.TryInsert(key) == expected.insert(key).second);
+            break;
+        case 1:
+            CHECK(set.TryRemove(key) == (expected.erase(key) == 1));
+            break;
+        case 2: {
+            bool present = expected.count(key) == 1;
+            CHECK(set.Replace(key, other) == present);
+            if (present) {
+                expected.erase(key);
+                expected.insert(other);
+            }
+            break;
+        }
+        default:
+            CHECK(set.Contains(key) == (expected.count(key) == 1));
+        }
+    }
+    CHECK(set.Size() == expected.size());
+    CHECK(set.SizeExact() == expected.size());
+    for (Key key : keys) CHECK(set.Contains(key) == (expected.count(key) == 1));
+
+    std::set<Key> seen;
+    set.ForEach([&seen](Key key) { CHECK(seen.insert(key).second); });
+    CHECK(seen == expected);
+    std::vector<Key> sorted = set.Snapshot().Keys();
+    CHECK(std::vector<Key>(expected.begin(), expected.end()) == sorted); // Signed keys in order
+
+    for (Key key : keys) set.Insert(key);
+    CHECK(set.Size() == keys.size());
+    CHECK(set.Contains(std::numeric_limits<Key>::min()) && set.Contains(std::numeric_limits<Key>::max()));
+    set.Clear();
+    CHECK(set.Size() == 0 && !set.Contains(0));
+}
+
+void test_against_set() {
+    check_against_set<char>();
+    check_against_set<signed char>();
+    check_against_set<uint8_t>();
+    check_against_set<int16_t>();
+    check_against_set<uint16_t>();
+}
+
+void test_replace() {
+    velocity::VelocitySet<int16_t> set;
+    set.Insert(-3);
+    CHECK(set.Replace(-3, -2)); // Same word
+    CHECK(!set.Contains(-3) && set.Contains(-2));
+    CHECK(set.Replace(-2, 1000)); // Another word
+    CHECK(!set.Contains(-2) && set.Contains(1000));
+    set.Insert(5);
+    CHECK(set.Replace(5, 1000)); // Onto a present key
+    CHECK(set.Size() == 1);
+    CHECK(!set.Replace(5, 6)); // Absent: unchanged
+    CHECK(!set.Contains(6));
+    CHECK(set.Replace(1000, 1000));
+    CHECK(set.Size() == 1);
+}
+
+void test_batches() {
+    velocity::VelocitySet<int8_t> set;
+    std::vector<int8_t> keys = {-128, 127, 0, -1, -1, 5, 127};
+    std::vector<uint8_t> flags(keys.size());
+    CHECK(set.InsertBatch(keys.data(), keys.size(), flags.data()) == 5);
+    CHECK((flags == std::vector<uint8_t>{1, 1, 1, 1, 0, 1, 0}));
+    std::vector<int8_t> probe = {-128, -127, 127, 4, 5};
+    std::vector<uint8_t> out(probe.size());
+    CHECK(set.ContainsBatch(probe.data(), probe.size(), out.data()) == 3);
+    CHECK((out == std::vector<uint8_t>{1, 0, 1, 0, 1}));
+    CHECK(set.RemoveBatch(keys.data(), keys.size(), flags.data()) == 5);
+    CHECK((flags == std::vector<uint8_t>{1, 1, 1, 1, 0, 1, 0}));
+    CHECK(set.Size() == 0);
+}
+
+// Set algebra on small keys combines the bitmaps word by word.
+void test_algebra() {
+    using Set = velocity::VelocitySet<uint16_t>;
+    Set a, b;
+    for (uint32_t k = 0; k < 40000; ++k) a.Insert(static_cast<uint16_t>(k));
+    for (uint32_t k = 30000; k < 65536; ++k) b.Insert(static_cast<uint16_t>(k));
+    std::unique_ptr<Set> both = Set::Intersect(a, b);
+    CHECK(both->Size() == 10000);
+    CHECK(both->Contains(30000) && both->Contains(39999) && !both->Contains(40000));
+    CHECK(a.Subtract(b) == 10000 && a.Size() == 30000);
+    CHECK(a.UnionWith(b) == 35536 && a.Size() == 65536);
+    CHECK(a.IntersectWith(b) == 30000 && a.Size() == 35536);
+}
+
+// The lock policy is ignored: threads updating keys in the same words never
+// take a lock, and no update is lost.
+void test_concurrent() {
+    velocity::VelocitySet<uint16_t, velocity::UnorderedSetStorage, velocity::IdentityHash, CountingLock> set;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, t]() {
+            for (int round = 0; round < 20; ++round) {
+                for (uint32_t k = t; k < 65536; k += 4) set.Insert(static_cast<uint16_t>(k));
+                for (uint32_t k = t; k < 65536; k += 8) set.Remove(static_cast<uint16_t>(k));
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(g_locks.load() == 0);
+    CHECK(set.SizeExact() == 32768);
+    for (uint32_t k = 0; k < 65536; ++k) CHECK(set.Contains(static_cast<uint16_t>(k)) == (k % 8 >= 4));
+}
+
+} // namespace
+
+int main() {
+    test_against_set();
+    test_replace();
+    test_batches();
+    test_algebra();
+    test_concurrent();
+    std::puts("small_keys_test: all passed");
+    return 0;
+}
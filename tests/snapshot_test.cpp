@@ -0,0 +1,144 @@
+/************************************************************
+ * snapshot_test.cpp
+ *
+ * Tests for Snapshot and SizeExact: a snapshot keeps the
+ * contents it was taken with while the set changes, and both
+ * see the set at a single instant while writers run, in
+ * buckets, key bitmaps and DenseRange bitmaps alike.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/snapshot_test.cpp -o snapshot_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Changes after the snapshot point, including a resize and a Clear, do not
+// show through.
+void test_isolation() {
+    using Set = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    Set set(Set::DenseRange{0, 1000});
+    for (uint64_t k = 0; k < 2000; ++k) set.Insert(k * 3); // Range and bucket keys
+    Set::SnapshotView view = set.Snapshot();
+    for (uint64_t k = 0; k < 2000; k += 2) set.Remove(k * 3);
+    for (uint64_t k = 0; k < 50000; ++k) set.Insert(k * 3 + 1); // Splits
+    set.Clear();
+    CHECK(view.Size() == 2000);
+    CHECK(view.Keys().size() == 2000);
+    for (uint64_t k = 0; k < 2000; ++k) {
+        CHECK(view.Contains(k * 3));
+        CHECK(!view.Contains(k * 3 + 1));
+    }
+    size_t visited = 0;
+    view.ForEach([&](uint64_t key) {
+        CHECK(key % 3 == 0 && key < 6000);
+        ++visited;
+    });
+    CHECK(visited == 2000);
+    CHECK(set.Snapshot().Size() == 0);
+
+    velocity::VelocitySet<int8_t> small;
+    for (int k = -128; k < 128; k += 2) small.Insert(static_cast<int8_t>(k));
+    velocity::VelocitySet<int8_t>::SnapshotView small_view = small.Snapshot();
+    small.Clear();
+    CHECK(small_view.Size() == 128);
+    for (int k = -128; k < 128; ++k) CHECK(small_view.Contains(static_cast<int8_t>(k)) == (k % 2 == 0));
+}
+
+// Writers move tokens from key to key with Replace, which never changes the
+// size at any instant: every SizeExact and Snapshot must count all tokens.
+// Token t only visits keys congruent to t modulo kTokens, and each move
+// crosses a 64-key word, so a word-by-word read could catch a token in two
+// places or in none.
+template <typename Set, typename Key>
+void check_moving_tokens(Set& set, uint64_t first, uint64_t range) {
+    constexpr uint64_t kTokens = 32;
+    auto key = [first](uint64_t position) { return static_cast<Key>(first + position); };
+    for (uint64_t t = 0; t < kTokens; ++t) set.Insert(key(t));
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (uint64_t w = 0; w < 2; ++w) {
+        writers.emplace_back([&set, &done, &key, range, w]() {
+            std::vector<uint64_t> at;
+            for (uint64_t t = w; t < kTokens; t += 2) at.push_back(t);
+            for (uint64_t step = 0; !done.load(); ++step) {
+                uint64_t& position = at[step % at.size()];
+                uint64_t next = (position + 3 * kTokens) % range;
+                CHECK(set.Replace(key(position), key(next)));
+                position = next;
+            }
+        });
+    }
+    for (int round = 0; round < 300; ++round) {
+        CHECK(set.SizeExact() == kTokens);
+        if (round % 10 == 0) CHECK(set.Snapshot().Size() == kTokens);
+    }
+    done.store(true);
+    for (std::thread& writer : writers) writer.join();
+    CHECK(set.SizeExact() == kTokens);
+}
+
+void test_moving_tokens() {
+    velocity::VelocitySet<uint16_t> small;
+    check_moving_tokens<decltype(small), uint16_t>(small, 0, 65536);
+    velocity::VelocitySet<char> chars;
+    check_moving_tokens<decltype(chars), char>(chars, 0, 256);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    DenseSet dense(DenseSet::DenseRange{1 << 20, 1 << 16});
+    check_moving_tokens<DenseSet, uint64_t>(dense, 1 << 20, 1 << 16);
+    velocity::VelocitySet<uint64_t> buckets(16); // Replace locks both buckets
+    check_moving_tokens<decltype(buckets), uint64_t>(buckets, 0, 1 << 16);
+}
+
+// One writer inserts a range key and then a bucket key, the other the
+// reverse, pair after pair. A snapshot that holds the second key of a pair
+// must hold the first, and no pair may be skipped.
+void test_range_and_buckets_agree() {
+    using Set = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    constexpr uint64_t kPairs = 200000;
+    constexpr uint64_t kSpilled = uint64_t{1} << 40;
+    Set set(Set::DenseRange{0, 2 * kPairs});
+    std::thread range_first([&set]() {
+        for (uint64_t i = 0; i < kPairs; ++i) {
+            set.Insert(2 * i);
+            set.Insert(kSpilled + 2 * i);
+        }
+    });
+    std::thread buckets_first([&set]() {
+        for (uint64_t i = 0; i < kPairs; ++i) {
+            set.Insert(kSpilled + 2 * i + 1);
+            set.Insert(2 * i + 1);
+        }
+    });
+    for (int round = 0; round < 20; ++round) {
+        Set::SnapshotView view = set.Snapshot();
+        for (uint64_t i = 0; i + 1 < kPairs; ++i) {
+            CHECK(!view.Contains(kSpilled + 2 * i) || view.Contains(2 * i));
+            CHECK(!view.Contains(2 * i + 1) || view.Contains(kSpilled + 2 * i + 1));
+            CHECK(!view.Contains(2 * (i + 1)) || view.Contains(kSpilled + 2 * i));
+            CHECK(!view.Contains(kSpilled + 2 * (i + 1) + 1) || view.Contains(2 * i + 1));
+        }
+    }
+    range_first.join();
+    buckets_first.join();
+    CHECK(set.SizeExact() == 4 * kPairs);
+}
+
+} // namespace
+
+int main() {
+    test_isolation();
+    test_moving_tokens();
+    test_range_and_buckets_agree();
+    std::puts("snapshot_test: all passed");
+    return 0;
+}
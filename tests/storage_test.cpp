@@ -0,0 +1,133 @@
+/************************************************************
+ * storage_test.cpp
+ *
+ * Tests for the bucket storage backends: each is driven with a
+ * random insert/erase/clear sequence and compared with
+ * std::set, on its own and inside a VelocitySet. Also checks
+ * lock-free Contains against a writer in the same bucket.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/storage_test.cpp -o storage_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <thread>
+
+namespace
+{
+
+template <typename Storage, typename T>
+std::set<T> keys_of(const Storage& storage) {
+    std::set<T> keys;
+    storage.for_each([&](const T& key) { CHECK(keys.insert(key).second); }); // Each key once
+    return keys;
+}
+
+// A small key range makes erases hit often, so tombstones pile up and
+// are reused or purged.
+template <template <typename> class Storage, typename T>
+void check_storage(uint64_t range) {
+    Storage<T> storage;
+    std::set<T> expected;
+    std::mt19937_64 rng(11);
+    for (int op = 0; op < 200000; ++op) {
+        T key = static_cast<T>(rng() % range);
+        switch (rng() % 8) {
+        case 0:
+        case 1:
+        case 2:
+            CHECK(storage.insert(key) == expected.insert(key).second);
+            break;
+        case 3:
+        case 4:
+            CHECK(storage.erase(key) == (expected.erase(key) == 1));
+            break;
+        default:
+            CHECK(storage.contains(key) == (expected.count(key) == 1));
+        }
+        CHECK(storage.size() == expected.size());
+        if (op % 50000 == 49999) {
+            CHECK((keys_of<Storage<T>, T>(storage) == expected));
+            storage.clear();
+            expected.clear();
+            CHECK(storage.size() == 0);
+        }
+    }
+    for (uint64_t k = 0; k < range; ++k) storage.insert(static_cast<T>(k)); // Grows the table
+    for (uint64_t k = 0; k < range; ++k) CHECK(storage.contains(static_cast<T>(k)));
+    CHECK(storage.size() == range);
+}
+
+template <template <typename> class Storage>
+void check_in_set() {
+    velocity::VelocitySet<int64_t, Storage> set(8, 4);
+    for (int64_t k = -50000; k < 50000; ++k) set.Insert(k * 3);
+    for (int64_t k = -50000; k < 50000; k += 2) set.Remove(k * 3);
+    CHECK(set.Size() == 50000);
+    for (int64_t k = -50000; k < 50000; ++k) {
+        CHECK(set.Contains(k * 3) == (k % 2 != 0));
+        CHECK(!set.Contains(k * 3 + 1));
+    }
+}
+
+void test_unordered_set_storage() {
+    check_storage<velocity::UnorderedSetStorage, uint64_t>(1000);
+    check_in_set<velocity::UnorderedSetStorage>();
+}
+
+void test_flat_storage() {
+    check_storage<velocity::FlatStorage, uint64_t>(1000);
+    check_storage<velocity::FlatStorage, int32_t>(100);
+    check_in_set<velocity::FlatStorage>();
+}
+
+void test_swiss_storage() {
+    check_storage<velocity::SwissStorage, uint64_t>(1000);
+    check_storage<velocity::SwissStorage, int16_t>(300);
+    check_storage<velocity::SwissStorage, uint64_t>(100000); // Spans many control groups
+    check_in_set<velocity::SwissStorage>();
+}
+
+// Lock-free Contains on FlatStorage while a writer churns the same bucket,
+// growing and purging its table: stable keys are always found and keys
+// never inserted never are.
+void test_optimistic_reads() {
+    using Set = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    constexpr uint64_t kStable = 500;
+    Set set(1, 1 << 20); // One bucket that never splits
+    for (uint64_t k = 0; k < kStable; ++k) set.Insert(k);
+    std::atomic<bool> done{false};
+    std::thread writer([&set, &done]() {
+        for (int round = 0; round < 200; ++round) {
+            for (uint64_t k = 0; k < 2000; ++k) set.Insert(1000000 + round * 2000 + k);
+            for (uint64_t k = 0; k < 2000; ++k) set.Remove(1000000 + round * 2000 + k);
+        }
+        done.store(true);
+    });
+    while (!done.load()) {
+        for (uint64_t k = 0; k < kStable; ++k) {
+            CHECK(set.Contains(k));
+            CHECK(!set.Contains(kStable + k));
+        }
+    }
+    writer.join();
+    CHECK(set.SizeExact() == kStable);
+}
+
+} // namespace
+
+int main() {
+    test_unordered_set_storage();
+    test_flat_storage();
+    test_swiss_storage();
+    test_optimistic_reads();
+    std::puts("storage_test: all passed");
+    return 0;
+}
@@ -0,0 +1,66 @@
+/************************************************************
+ * test_util.h
+ *
+ * Minimal check macro shared by the standalone tests. Unlike
+ * assert(), CHECK stays active in optimized (-DNDEBUG) builds.
+ * TempDir gives file tests a fresh directory (POSIX only).
+ ************************************************************/
+
+#ifndef VELOCITY_TEST_UTIL_H
+#define VELOCITY_TEST_UTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+                         #condition);                                           \
+            std::exit(1);                                                       \
+        }                                                                       \
+    } while (0)
+
+/** @brief A directory under /tmp, removed with its files on destruction. */
+class TempDir {
+public:
+    TempDir() {
+        char name[] = "/tmp/velocity_test.XXXXXX";
+        CHECK(::mkdtemp(name) != nullptr);
+        path_ = name;
+    }
+
+    ~TempDir() {
+        for (const std::string& name : Names()) ::unlink(File(name).c_str());
+        ::rmdir(path_.c_str());
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    const std::string& Path() const { return path_; }
+    std::string File(const std::string& name) const { return path_ + "/" + name; }
+
+    /** @brief Names of the entries in the directory, without "." and "..". */
+    std::vector<std::string> Names() const {
+        std::vector<std::string> names;
+        DIR* dir = ::opendir(path_.c_str());
+        CHECK(dir != nullptr);
+        while (const dirent* entry = ::readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") names.push_back(name);
+        }
+        ::closedir(dir);
+        return names;
+    }
+
+private:
+    std::string path_;
+};
+
+#endif // VELOCITY_TEST_UTIL_H
@@ -0,0 +1,155 @@
+/************************************************************
+ * try_ops_test.cpp
+ *
+ * Tests for TryInsert, TryRemove and Replace: results against
+ * std::set, a single winner when threads race on one key, and
+ * Replace never losing a key a reader is looking for.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I. tests/try_ops_test.cpp -o try_ops_test
+ ************************************************************/
+
+#include "velocity_set.h"
+#include "tests/test_util.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+template <typename Set, typename Key>
+void check_against_set(Set& set, uint64_t range) {
+    std::set<Key> expected;
+    std::mt19937_64 rng(3);
+    for (int op = 0; op < 100000; ++op) {
+        Key key = static_cast<Key>(rng() % range);
+        Key other = static_cast<Key>(rng() % range);
+        switch (rng() % 3) {
+        case 0:
+            CHECK(set.TryInsert(key) == expected.insert(key).second);
+            break;
+        case 1:
+            CHECK(set.TryRemove(key) == (expected.erase(key) == 1));
+            break;
+        default:
+            bool present = expected.count(key) == 1;
+            CHECK(set.Replace(key, other) == present);
+            if (present) {
+                expected.erase(key);
+                expected.insert(other);
+            }
+        }
+        CHECK(set.Size() == expected.size());
+    }
+    for (uint64_t k = 0; k < range; ++k) {
+        Key key = static_cast<Key>(k);
+        CHECK(set.Contains(key) == (expected.count(key) == 1));
+    }
+}
+
+void test_against_set() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_against_set<decltype(set), uint64_t>(set, 5000);
+    velocity::VelocitySet<int64_t, velocity::FlatStorage, velocity::Murmur3Hash> flat(4, 8);
+    check_against_set<decltype(flat), int64_t>(flat, 5000);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::SwissStorage>;
+    DenseSet dense(DenseSet::DenseRange{1000, 2000}); // Replace within, into and out of the bitmap
+    check_against_set<DenseSet, uint64_t>(dense, 5000);
+    velocity::VelocitySet<int16_t> small;
+    check_against_set<decltype(small), int16_t>(small, 65536);
+}
+
+void test_replace() {
+    velocity::VelocitySet<uint64_t> set;
+    CHECK(!set.Replace(1, 2)); // Absent: unchanged
+    CHECK(set.Size() == 0 && !set.Contains(2));
+    set.Insert(1);
+    CHECK(set.Replace(1, 1));
+    CHECK(set.Contains(1) && set.Size() == 1);
+    set.Insert(2);
+    CHECK(set.Replace(1, 2)); // The new key was already there
+    CHECK(!set.Contains(1) && set.Contains(2));
+    CHECK(set.Size() == 1 && set.SizeExact() == 1);
+}
+
+// Threads race to claim the same keys: each key has exactly one winner, for
+// insertion and again for removal.
+template <typename Set>
+uint64_t count_winners(Set& set, uint64_t keys, bool insert) {
+    std::vector<uint64_t> wins(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, &wins, keys, insert, t]() {
+            for (uint64_t k = 0; k < keys; ++k) wins[t] += insert ? set.TryInsert(k) : set.TryRemove(k);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    return wins[0] + wins[1] + wins[2] + wins[3];
+}
+
+template <typename Set>
+void check_single_winner(Set& set, uint64_t keys) {
+    CHECK(count_winners(set, keys, true) == keys);
+    CHECK(set.SizeExact() == keys);
+    CHECK(count_winners(set, keys, false) == keys);
+    CHECK(set.SizeExact() == 0);
+}
+
+void test_single_winner() {
+    velocity::VelocitySet<uint64_t> set(4, 8);
+    check_single_winner(set, 50000);
+    using DenseSet = velocity::VelocitySet<uint64_t, velocity::FlatStorage>;
+    DenseSet dense(DenseSet::DenseRange{0, 25000});
+    check_single_winner(dense, 50000);
+    velocity::VelocitySet<uint16_t> small;
+    check_single_winner(small, 65536);
+}
+
+// Tokens hop from key to key by Replace, usually across buckets. Replacing
+// a present key with an absent one never changes the size, so a reader
+// sees the same count throughout.
+void test_concurrent_replace() {
+    velocity::VelocitySet<uint64_t, velocity::FlatStorage> set(16);
+    constexpr uint64_t kTokens = 64;
+    for (uint64_t k = 0; k < kTokens; ++k) set.Insert(k);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&set, t]() {
+            // Thread t owns tokens t, t + 4, ...; each hops through 1000 keys
+            for (uint64_t k = t; k < kTokens; k += 4) {
+                uint64_t at = k;
+                for (uint64_t hop = 1; hop <= 1000; ++hop) {
+                    uint64_t next = k + hop * kTokens;
+                    CHECK(set.Replace(at, next));
+                    at = next;
+                }
+            }
+        });
+    }
+    std::atomic<bool> done{false};
+    std::thread reader([&set, &done]() {
+        while (!done.load()) CHECK(set.Size() == kTokens);
+    });
+    for (std::thread& thread : threads) thread.join();
+    done.store(true);
+    reader.join();
+    CHECK(set.SizeExact() == kTokens);
+    for (uint64_t k = 0; k < kTokens; ++k) CHECK(set.Contains(k + 1000 * kTokens) && !set.Contains(k));
+}
+
+} // namespace
+
+int main() {
+    test_against_set();
+    test_replace();
+    test_single_winner();
+    test_concurrent_replace();
+    std::puts("try_ops_test: all passed");
+    return 0;
+}
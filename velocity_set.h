@@ -4,9 +4,33 @@
  * VelocitySet: An ultra-fast concurrent set for integer keys.
  * Implementation uses:
  *  - Minimal spinlock with Intel intrinsics (`_mm_pause`)
- *  - Fine-grained per-bucket locking
- *  - Fast bitwise mask hashing (requires power-of-two bucket count)
+ *  - Fine-grained per-bucket locking with pluggable lock policies, or a
+ *    fixed number of lock stripes independent of the bucket count
+ *  - Batched inserts/removes that lock each touched bucket once, and
+ *    batched lookups that prefetch a group of keys before resolving them
+ *  - Per-bucket iteration (ForEach), optionally spread across threads
+ *  - Point-in-time snapshots by per-bucket copy-on-write
+ *  - Binary save and memory-mapped parallel reload, laid out by bucket
+ *  - Set algebra (union, intersection, difference) bucket pair by bucket
+ *    pair across threads when two sets share a layout
+ *  - Constant-time Clear() through generation-tagged buckets reset lazily
+ *  - Lock-free atomic bitmap in place of the buckets for 8- and 16-bit keys
+ *  - Optional dense key range kept in an atomic bitmap, other keys spilling
+ *    to the buckets
+ *  - Lock-free Size() from per-thread padded counters, plus an exact
+ *    SizeExact() by double collect over bucket versions
+ *  - Online growth and shrinking by incremental bucket splits (linear hashing)
+ *  - Seqlock-validated lock-free lookups for storages that support them
+ *  - LockFreeVelocitySet: CAS-based open addressing with no locks at all
+ *  - DurableVelocitySet: sharded write-ahead log with group commit, plus
+ *    checkpoints, replayed on startup
+ *  - Fast bitwise mask hashing (requires power-of-two initial bucket count)
+ *    over a pluggable hash policy (identity by default)
  *  - Cache-line alignment to reduce false sharing
+ *  - Pluggable per-bucket storage (node-based, flat open addressing,
+ *    SwissTable-style SIMD control-byte probing, or adaptive: an inline
+ *    sorted array, a table or a local bitmap as occupancy changes, or
+ *    Roaring-style compressed chunk containers)
  *
  * Recommended compiler flags (example):
  *   g++ -std=c++17 -O3 -march=native -funroll-loops \
@@ -28,13 +52,42 @@
 #include <atomic>
 #include <unordered_set>
 #include <vector>
+#include <memory>         // For std::unique_ptr
+#include <cstdint>        // For uint8_t, uint32_t, uint64_t
+#include <cstring>        // For std::memset
+#include <new>            // For placement new
 #include <thread>         // For std::thread::hardware_concurrency
 #include <immintrin.h>    // For _mm_pause() - x86/x64 specific
 #include <cstddef>        // For size_t
 #include <type_traits>    // For std::is_integral
-#include <stdexcept>      // For std::invalid_argument
+#include <stdexcept>      // For std::invalid_argument, std::length_error
 #include <cmath>          // For std::log2, std::ceil
 #include <limits>         // For std::numeric_limits
+#include <algorithm>      // For std::min, std::max
+#include <exception>      // For std::terminate
+#include <random>         // For std::random_device
+#include <mutex>          // For std::mutex
+#include <string>         // For std::string
+#include <cstdio>         // For std::FILE, std::fopen, std::fwrite
+#include <cerrno>         // For errno
+#include <system_error>   // For std::system_error
+#include <condition_variable> // For std::condition_variable
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <dirent.h>       // For opendir, readdir
+    #include <fcntl.h>        // For open
+    #include <stdlib.h>       // For mkstemp
+    #include <sys/mman.h>     // For mmap, madvise
+    #include <sys/stat.h>     // For fstat, fchmod, umask
+    #include <unistd.h>       // For close, write, fsync, fdatasync
+    #define VELOCITY_POSIX_FILES 1
+#endif
+
+#if defined(__linux__)
+    #include <linux/futex.h>  // For FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+    #include <sys/syscall.h>  // For SYS_futex
+    #include <unistd.h>       // For syscall
+#endif
 
 // Pre-check for potential non-x86 compilation if intrinsics are essential
 #if !defined(__x86_64__) && !defined(_M_X64) && !defined(__i386__) && !defined(_M_IX86)
@@ -45,289 +98,5124 @@
 namespace velocity
 {
 
-// --- Configuration ---
-constexpr int kCacheLineSize = 64; // Assumed cache line size for alignment
+// --- Configuration ---
+constexpr int kCacheLineSize = 64; // Assumed cache line size for alignment
+constexpr int kOptimisticReadAttempts = 4; // Lock-free read retries before locking
+
+namespace detail
+{
+
+/** @brief CPU hint for spin-wait loops (`_mm_pause()` on x86/x64). */
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    _mm_pause(); // Intrinsics for x86/x64
+#else
+    // Basic busy-wait for other architectures or if intrinsics are disabled
+    // Consider std::this_thread::yield() as an alternative,
+    // but its behavior/performance varies widely.
+#endif
+}
+
+/** @brief Hint to pull the cache line holding `address` into all cache levels. */
+inline void prefetch(const void* address) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#endif
+}
+
+/** @brief 64-bit finalizer (murmur3 fmix64): every input bit affects every output bit. */
+inline uint64_t mix_bits(uint64_t x) noexcept {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief Hash used for probing inside a bucket.
+ *
+ * All keys of a bucket share the low bits of the bucket hash, so the
+ * in-bucket slot must come from a value independent of it, even when the
+ * hash policy is itself `mix_bits` (hence the salt).
+ */
+inline uint64_t slot_hash(uint64_t x) noexcept {
+    return mix_bits(x + 0x9E3779B97F4A7C15ULL);
+}
+
+/**
+ * @brief Finds the smallest power of two greater than or equal to n.
+ * @param n The input number.
+ * @return The next power of two. Returns 1 if n is 0.
+ */
+inline size_t next_power_of_two(size_t n) noexcept {
+    if (n == 0) return 1;
+    // Efficient bit manipulation way:
+    n--;
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;
+    if constexpr (sizeof(size_t) > 4) { // Handle 64-bit size_t
+         n |= n >> 32;
+    }
+    n++;
+    return n;
+
+    // Alternative using floating point (potentially slightly less performant/precise for edge cases):
+    // if (n == 0) return 1;
+    // return static_cast<size_t>(1) << static_cast<size_t>(std::ceil(std::log2(static_cast<double>(n))));
+}
+
+/**
+ * @brief Checks if a number is a power of two.
+ * @param n The number to check.
+ * @return true if n is > 0 and a power of two, false otherwise.
+ */
+inline bool is_power_of_two(size_t n) noexcept {
+    return (n > 0) && ((n & (n - 1)) == 0);
+}
+
+/** @brief Index of the highest set bit. `n` must be non-zero. */
+inline unsigned floor_log2(uint64_t n) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse64(&index, n);
+    return static_cast<unsigned>(index);
+#else
+    return 63u - static_cast<unsigned>(__builtin_clzll(n));
+#endif
+}
+
+/** @brief Detects storage backends that declare `kOptimisticReads = true`. */
+template <typename S, typename = void>
+struct has_optimistic_reads : std::false_type {};
+
+template <typename S>
+struct has_optimistic_reads<S, std::void_t<decltype(S::kOptimisticReads)>>
+    : std::bool_constant<S::kOptimisticReads> {};
+
+/** @brief Detects storage backends that provide a `prefetch(const T&)` hint. */
+template <typename S, typename T, typename = void>
+struct has_prefetch : std::false_type {};
+
+template <typename S, typename T>
+struct has_prefetch<S, T, std::void_t<decltype(std::declval<const S&>().prefetch(std::declval<const T&>()))>>
+    : std::true_type {};
+
+/** @brief Storage's `kDefaultMaxBucketLoad` if it declares one, else `fallback`. */
+template <typename S, typename = void>
+struct storage_bucket_load {
+    static constexpr size_t value(size_t fallback) noexcept { return fallback; }
+};
+
+template <typename S>
+struct storage_bucket_load<S, std::void_t<decltype(S::kDefaultMaxBucketLoad)>> {
+    static constexpr size_t value(size_t) noexcept { return S::kDefaultMaxBucketLoad; }
+};
+
+template <typename H, typename = void>
+struct has_equality : std::false_type {};
+
+template <typename H>
+struct has_equality<H, std::void_t<decltype(std::declval<const H&>() == std::declval<const H&>())>>
+    : std::true_type {};
+
+/**
+ * @brief Whether two hash policy instances hash every key alike: always for
+ * stateless policies, for stateful ones only if they compare equal.
+ */
+template <typename H>
+bool same_hash(const H& a, const H& b) noexcept {
+    if constexpr (std::is_empty_v<H>) {
+        return true;
+    } else if constexpr (has_equality<H>::value) {
+        return a == b;
+    } else {
+        return false;
+    }
+}
+
+/** @brief Index of the lowest set bit. `x` must be non-zero. */
+inline unsigned count_trailing_zeros(uint32_t x) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+}
+
+/** @brief Index of the lowest set bit of a 64-bit word. `x` must be non-zero. */
+inline unsigned count_trailing_zeros64(uint64_t x) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+/** @brief Number of set bits in a 64-bit word. */
+inline unsigned popcount64(uint64_t x) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return static_cast<unsigned>(__popcnt64(x));
+#else
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#endif
+}
+
+/**
+ * @brief A group of control bytes matched in parallel by `SwissStorage`.
+ *
+ * 32 bytes per compare with AVX2, 16 with SSE2, and a scalar loop over 8
+ * bytes elsewhere. Bit i of every returned mask refers to slot i of the group.
+ */
+struct ControlGroup {
+    // Control byte encoding: full slots hold the 7-bit fingerprint (high bit
+    // clear); empty and deleted slots have the high bit set.
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xFE;
+
+#if defined(__AVX2__)
+    static constexpr size_t kWidth = 32;
+    __m256i ctrl;
+
+    explicit ControlGroup(const uint8_t* p) noexcept
+        : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))) {}
+
+    uint32_t match(uint8_t h2) const noexcept {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(ctrl, _mm256_set1_epi8(static_cast<char>(h2)))));
+    }
+    uint32_t match_empty() const noexcept { return match(kEmpty); }
+    uint32_t match_empty_or_deleted() const noexcept {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(ctrl));
+    }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    static constexpr size_t kWidth = 16;
+    __m128i ctrl;
+
+    explicit ControlGroup(const uint8_t* p) noexcept
+        : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+
+    uint32_t match(uint8_t h2) const noexcept {
+        return static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(h2)))));
+    }
+    uint32_t match_empty() const noexcept { return match(kEmpty); }
+    uint32_t match_empty_or_deleted() const noexcept {
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+#else
+    static constexpr size_t kWidth = 8;
+    uint8_t ctrl[kWidth];
+
+    explicit ControlGroup(const uint8_t* p) noexcept { std::memcpy(ctrl, p, kWidth); }
+
+    uint32_t match(uint8_t h2) const noexcept {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kWidth; ++i) mask |= static_cast<uint32_t>(ctrl[i] == h2) << i;
+        return mask;
+    }
+    uint32_t match_empty() const noexcept { return match(kEmpty); }
+    uint32_t match_empty_or_deleted() const noexcept {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kWidth; ++i) mask |= static_cast<uint32_t>(ctrl[i] >> 7) << i;
+        return mask;
+    }
+#endif
+};
+
+/** @brief Cheap per-thread xorshift generator for randomized backoff. */
+inline uint32_t thread_random() noexcept {
+    static thread_local uint32_t state = 0;
+    if (state == 0) {
+        // Seed from the address of the per-thread state; never zero
+        state = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&state) >> 4) | 1u;
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/** @brief A small per-thread number, assigned in order of first use. */
+inline uint32_t thread_index() noexcept {
+    static std::atomic<uint32_t> next{0};
+    static thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+/**
+ * @brief Blocks while `*word == expected` (Linux futex). Elsewhere, yields the
+ * CPU once; callers re-check their condition in a loop either way.
+ */
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected) noexcept {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)expected;
+    std::this_thread::yield();
+#endif
+}
+
+/** @brief Wakes one thread blocked in `futex_wait` on word. */
+inline void futex_wake_one(std::atomic<uint32_t>* word) noexcept {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+/** @brief Detects lock policies offering `lock_shared()`/`unlock_shared()`. */
+template <typename L, typename = void>
+struct has_shared_lock : std::false_type {};
+
+template <typename L>
+struct has_shared_lock<L, std::void_t<decltype(std::declval<L&>().lock_shared()),
+                                      decltype(std::declval<L&>().unlock_shared())>>
+    : std::true_type {};
+
+/** @brief Locks for reading: shared if the lock policy supports it. */
+template <typename L>
+void lock_for_read(L& lock) noexcept {
+    if constexpr (has_shared_lock<L>::value) {
+        lock.lock_shared();
+    } else {
+        lock.lock();
+    }
+}
+
+/** @brief Releases a lock taken with `lock_for_read()`. */
+template <typename L>
+void unlock_for_read(L& lock) noexcept {
+    if constexpr (has_shared_lock<L>::value) {
+        lock.unlock_shared();
+    } else {
+        lock.unlock();
+    }
+}
+
+/**
+ * @brief A fixed-size set of bit positions updated without locks.
+ *
+ * Each bit lives in a 64-bit word updated with `fetch_or`/`fetch_and` (or a
+ * CAS for a two-bit `replace`). Every update is bracketed by two counters of
+ * a per-thread-sharded writer count, so a reader can tell whether any update
+ * ran while it read: `read_begin`/`read_validate` give an optimistic,
+ * validated read of several words (as a seqlock does), and
+ * `pause_writers` holds new updates off for a read that must succeed.
+ * The same shards count the bits each update set or cleared, so `size` is
+ * O(1). Plain `for_each` reads the words one at a time: under concurrent
+ * updates it combines words read at slightly different moments.
+ */
+class AtomicBitmap {
+public:
+    explicit AtomicBitmap(size_t bits)
+        : word_count_((bits + 63) / 64), words_(new std::atomic<uint64_t>[word_count_]),
+          writers_(word_count_ != 0 ? new WriterShard[kWriterShards] : nullptr)
+    {
+        for (size_t i = 0; i < word_count_; ++i) words_[i].store(0, std::memory_order_relaxed);
+    }
+
+    /** @brief Sets a bit. @return true if it was clear. */
+    bool insert(size_t bit) noexcept {
+        WriteScope scope(*this);
+        bool added = set_bit(bit);
+        if (added) scope.adjust(1);
+        return added;
+    }
+
+    /** @brief Clears a bit. @return true if it was set. */
+    bool erase(size_t bit) noexcept {
+        WriteScope scope(*this);
+        bool erased = clear_bit(bit);
+        if (erased) scope.adjust(-1);
+        return erased;
+    }
+
+    bool contains(size_t bit) const noexcept {
+        return (words_[bit >> 6].load(std::memory_order_acquire) >> (bit & 63)) & 1;
+    }
+
+    void prefetch(size_t bit) const noexcept {
+        detail::prefetch(&words_[bit >> 6]);
+    }
+
+    /**
+     * @brief Clears old_bit and sets new_bit if old_bit is set. Atomic for
+     * `contains` when both bits share a word; otherwise old_bit is cleared
+     * first, then new_bit set. Validated reads never see the step between.
+     * @param added Set to whether new_bit was clear before.
+     * @return true if old_bit was set.
+     */
+    bool replace(size_t old_bit, size_t new_bit, bool& added) noexcept {
+        WriteScope scope(*this);
+        added = false;
+        uint64_t old_mask = uint64_t{1} << (old_bit & 63);
+        if ((old_bit >> 6) != (new_bit >> 6)) {
+            if (!clear_bit(old_bit)) return false;
+            added = set_bit(new_bit);
+            if (!added) scope.adjust(-1);
+            return true;
+        }
+        uint64_t new_mask = uint64_t{1} << (new_bit & 63);
+        std::atomic<uint64_t>& word = words_[old_bit >> 6];
+        uint64_t value = word.load(std::memory_order_relaxed);
+        do {
+            if ((value & old_mask) == 0) return false;
+        } while (!word.compare_exchange_weak(value, (value & ~old_mask) | new_mask,
+                                             std::memory_order_acq_rel, std::memory_order_relaxed));
+        added = (value & new_mask) == 0;
+        if (!added) scope.adjust(-1);
+        return true;
+    }
+
+    /**
+     * @brief Number of set bits, from the writer shards. Exact when no update
+     * is in flight, and within `read_begin`/`read_validate`.
+     */
+    size_t size() const noexcept {
+        uint64_t total = 0;
+        for (size_t i = 0; i < kWriterShards; ++i) total += writers_[i].bits.load(std::memory_order_relaxed);
+        // Shards hold deltas modulo 2^64 (one thread may clear what another set)
+        return static_cast<int64_t>(total) < 0 ? 0 : static_cast<size_t>(total); // Transient, under updates
+    }
+
+    /** @brief Clears every bit. Updates wait meanwhile, so none is half undone. */
+    void clear() noexcept {
+        pause_writers();
+        for (size_t i = 0; i < word_count_; ++i) words_[i].store(0, std::memory_order_release);
+        for (size_t i = 0; i < kWriterShards; ++i) writers_[i].bits.store(0, std::memory_order_relaxed);
+        resume_writers();
+    }
+
+    size_t word_count() const noexcept { return word_count_; }
+
+    /**
+     * @brief Word-wise union, intersection and difference with a bitmap of
+     * the same size, over words [begin, end): one atomic RMW per word.
+     * @return The number of bits set (unite) or cleared (intersect, subtract).
+     */
+    size_t unite(const AtomicBitmap& other, size_t begin, size_t end) noexcept {
+        WriteScope scope(*this);
+        size_t changed = 0;
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t theirs = other.words_[i].load(std::memory_order_acquire);
+            if (theirs == 0) continue;
+            changed += popcount64(theirs & ~words_[i].fetch_or(theirs, std::memory_order_acq_rel));
+        }
+        scope.adjust(static_cast<int64_t>(changed));
+        return changed;
+    }
+
+    size_t intersect(const AtomicBitmap& other, size_t begin, size_t end) noexcept {
+        WriteScope scope(*this);
+        size_t changed = 0;
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t theirs = other.words_[i].load(std::memory_order_acquire);
+            changed += popcount64(words_[i].fetch_and(theirs, std::memory_order_acq_rel) & ~theirs);
+        }
+        scope.adjust(-static_cast<int64_t>(changed));
+        return changed;
+    }
+
+    size_t subtract(const AtomicBitmap& other, size_t begin, size_t end) noexcept {
+        WriteScope scope(*this);
+        size_t changed = 0;
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t theirs = other.words_[i].load(std::memory_order_acquire);
+            if (theirs == 0) continue;
+            changed += popcount64(words_[i].fetch_and(~theirs, std::memory_order_acq_rel) & theirs);
+        }
+        scope.adjust(-static_cast<int64_t>(changed));
+        return changed;
+    }
+
+    /** @brief Calls fn(bit) for every set bit of words [begin, end), in increasing order. */
+    template <typename Fn>
+    void for_each(size_t begin, size_t end, Fn&& fn) const {
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t word = words_[i].load(std::memory_order_acquire);
+            while (word != 0) {
+                fn(i * 64 + count_trailing_zeros64(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    /**
+     * @brief Starts an optimistic read of the words.
+     * @param stamp Receives the writer count to pass to `read_validate`.
+     * @return false if an update is in progress (the read cannot succeed).
+     */
+    bool read_begin(uint64_t& stamp) const noexcept {
+        uint64_t begun = 0;
+        uint64_t ended = 0;
+        for (size_t i = 0; i < kWriterShards; ++i) begun += writers_[i].begun.load(std::memory_order_seq_cst);
+        for (size_t i = 0; i < kWriterShards; ++i) ended += writers_[i].ended.load(std::memory_order_acquire);
+        stamp = begun;
+        return begun == ended;
+    }
+
+    /**
+     * @brief Ends an optimistic read started by `read_begin`.
+     * @return true if no update ran since: the words read in between all
+     *         held those values together, for the whole read.
+     */
+    bool read_validate(uint64_t stamp) const noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // Recount strictly after the reads
+        uint64_t begun = 0;
+        for (size_t i = 0; i < kWriterShards; ++i) begun += writers_[i].begun.load(std::memory_order_relaxed);
+        return begun == stamp;
+    }
+
+    /**
+     * @brief Makes new updates wait and waits for running ones to finish, so
+     * the words stay unchanged until `resume_writers`. Must not be called
+     * by a thread inside an update of this bitmap.
+     */
+    void pause_writers() const noexcept {
+        paused_.fetch_add(1, std::memory_order_seq_cst);
+        uint64_t stamp;
+        while (!read_begin(stamp) || !read_validate(stamp)) std::this_thread::yield();
+    }
+
+    void resume_writers() const noexcept {
+        paused_.fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t kWriterShards = 16; // Power of two
+
+    /** @brief Updates started and finished by the threads of one shard, and their net bit count. */
+    struct alignas(kCacheLineSize) WriterShard {
+        std::atomic<uint64_t> begun{0};
+        std::atomic<uint64_t> ended{0};
+        std::atomic<uint64_t> bits{0};
+    };
+
+    /** @brief Counts one update for `read_validate`, waiting out `pause_writers`. */
+    class WriteScope {
+    public:
+        explicit WriteScope(AtomicBitmap& bitmap) noexcept
+            : shard_(bitmap.writers_[detail::thread_index() & (kWriterShards - 1)])
+        {
+            for (;;) {
+                // Dekker-style with pause_writers: either it sees this entry or
+                // this sees the pause
+                shard_.begun.fetch_add(1, std::memory_order_seq_cst);
+                if (bitmap.paused_.load(std::memory_order_seq_cst) == 0) return;
+                shard_.ended.fetch_add(1, std::memory_order_release);
+                while (bitmap.paused_.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+            }
+        }
+
+        ~WriteScope() { shard_.ended.fetch_add(1, std::memory_order_release); }
+
+        /** @brief Records bits set (positive) or cleared (negative) by this update. */
+        void adjust(int64_t delta) noexcept {
+            if (delta != 0) shard_.bits.fetch_add(static_cast<uint64_t>(delta), std::memory_order_relaxed);
+        }
+
+        WriteScope(const WriteScope&) = delete;
+        WriteScope& operator=(const WriteScope&) = delete;
+
+    private:
+        WriterShard& shard_;
+    };
+
+    bool set_bit(size_t bit) noexcept {
+        uint64_t mask = uint64_t{1} << (bit & 63);
+        return (words_[bit >> 6].fetch_or(mask, std::memory_order_acq_rel) & mask) == 0;
+    }
+
+    bool clear_bit(size_t bit) noexcept {
+        uint64_t mask = uint64_t{1} << (bit & 63);
+        return (words_[bit >> 6].fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0;
+    }
+
+    size_t word_count_;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    std::unique_ptr<WriterShard[]> writers_; // Null for an empty bitmap, which is never updated
+    mutable std::atomic<uint32_t> paused_{0};
+};
+
+/**
+ * @brief Growable array of keys handed to the batch operations.
+ * Unlike `std::vector<T>` it has contiguous `data()` for every key type,
+ * `bool` included.
+ */
+template <typename T>
+class KeyBuffer {
+public:
+    void reserve(size_t capacity) {
+        if (capacity <= capacity_) return;
+        std::unique_ptr<T[]> keys(new T[capacity]);
+        std::copy(keys_.get(), keys_.get() + size_, keys.get());
+        keys_ = std::move(keys);
+        capacity_ = capacity;
+    }
+
+    void push_back(const T& key) {
+        if (size_ == capacity_) reserve(capacity_ == 0 ? 16 : capacity_ * 2);
+        keys_[size_++] = key;
+    }
+
+    /** @brief Keeps the first size keys. */
+    void truncate(size_t size) noexcept { size_ = std::min(size, size_); }
+    void clear() noexcept { size_ = 0; }
+
+    T* data() noexcept { return keys_.get(); }
+    const T* data() const noexcept { return keys_.get(); }
+    size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    T& operator[](size_t i) noexcept { return keys_[i]; }
+    const T* begin() const noexcept { return keys_.get(); }
+    const T* end() const noexcept { return keys_.get() + size_; }
+
+private:
+    std::unique_ptr<T[]> keys_;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+/**
+ * @brief Fixed 64-byte header of a `VelocitySet::SaveTo` file.
+ * It is followed by uint64_t offsets[bucket_count + 1] and then T keys[key_count].
+ * Bucket i holds keys [offsets[i], offsets[i + 1]), sorted; keys from
+ * offsets[bucket_count] on are the DenseRange keys. Stored in host byte order.
+ */
+struct SetFileHeader {
+    static constexpr uint64_t kMagic = 0x5445534C434F4C56; // "VLOCLSET"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kByteOrder = 0x01020304;    // Reads differently on a foreign-endian host
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_bytes;
+    uint32_t key_signed;
+    uint64_t hash_fingerprint; // Bucket placement of a few probe keys
+    uint64_t bucket_count;
+    uint64_t key_count;
+    uint64_t dense_base;
+    uint64_t dense_size;
+};
+static_assert(sizeof(SetFileHeader) == 64, "SetFileHeader must stay 64 bytes");
+
+/**
+ * @brief A whole file, read-only: memory-mapped where POSIX `mmap` is
+ * available, read into an aligned buffer elsewhere.
+ */
+class MappedFile {
+public:
+    /** @throws std::system_error if the file cannot be opened or read. */
+    explicit MappedFile(const std::string& path) {
+#if defined(VELOCITY_POSIX_FILES)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail(path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            int error = errno;
+            ::close(fd);
+            fail(path, error);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ != 0) {
+            void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                fail(path, error);
+            }
+            ::madvise(mapping, size_, MADV_WILLNEED); // Workers fault in different parts at once
+            data_ = static_cast<const unsigned char*>(mapping);
+        }
+        ::close(fd); // The mapping stays valid
+#else
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) fail(path);
+        if (std::fseek(file, 0, SEEK_END) == 0) {
+            long end = std::ftell(file);
+            if (end > 0) size_ = static_cast<size_t>(end);
+        }
+        buffer_.reset(new uint64_t[(size_ + 7) / 8]); // Keys need their natural alignment
+        std::rewind(file);
+        bool complete = std::fread(buffer_.get(), 1, size_, file) == size_;
+        std::fclose(file);
+        if (!complete) fail(path, EIO);
+        data_ = reinterpret_cast<const unsigned char*>(buffer_.get());
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(VELOCITY_POSIX_FILES)
+        if (data_ != nullptr) ::munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+
+private:
+    [[noreturn]] static void fail(const std::string& path, int error = errno) {
+        throw std::system_error(error, std::generic_category(), "VelocitySet: cannot read " + path);
+    }
+
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+#if !defined(VELOCITY_POSIX_FILES)
+    std::unique_ptr<uint64_t[]> buffer_;
+#endif
+};
+
+#if defined(VELOCITY_POSIX_FILES)
+/**
+ * @brief The process umask, read on first use. Reading it means setting it,
+ * so it is read once rather than on every save.
+ */
+inline mode_t process_umask() noexcept {
+    static const mode_t mask = [] {
+        mode_t current = ::umask(022);
+        ::umask(current);
+        return current;
+    }();
+    return mask;
+}
+#endif
+
+/**
+ * @brief Creates and opens a uniquely named file beside path, so concurrent
+ * writers of the same path never share it. The file gets the permissions of
+ * the file at path if there is one, else those a plain create would give.
+ * @param temp Receives the file's name.
+ * @throws std::system_error if the file cannot be created.
+ */
+inline std::FILE* create_temp_file(const std::string& path, std::string& temp) {
+#if defined(VELOCITY_POSIX_FILES)
+    temp = path + ".tmp.XXXXXX";
+    std::FILE* file = nullptr;
+    int fd = ::mkstemp(&temp[0]);
+    if (fd >= 0) {
+        // mkstemp leaves the file readable by its owner only
+        struct stat existing;
+        mode_t mode = ::stat(path.c_str(), &existing) == 0 ? existing.st_mode & 0777 : 0666 & ~process_umask();
+        ::fchmod(fd, mode);
+        file = ::fdopen(fd, "wb");
+        if (file == nullptr) {
+            int error = errno;
+            ::close(fd);
+            ::unlink(temp.c_str());
+            errno = error;
+        }
+    }
+#else
+    static std::atomic<uint64_t> next_id{0};
+    temp = path + ".tmp." + std::to_string(next_id.fetch_add(1, std::memory_order_relaxed));
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+#endif
+    if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "VelocitySet: cannot write " + path);
+    }
+    return file;
+}
+
+/**
+ * @brief Makes a rename or creation of path durable by syncing the
+ * directory holding it. Does nothing without POSIX file support.
+ * @throws std::system_error if the directory cannot be synced.
+ */
+inline void sync_parent_directory(const std::string& path) {
+#if defined(VELOCITY_POSIX_FILES)
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+    int error = fd < 0 ? errno : (::fsync(fd) == 0 ? 0 : errno);
+    if (fd >= 0) ::close(fd);
+    if (error != 0) {
+        throw std::system_error(error, std::generic_category(), "VelocitySet: cannot sync " + directory);
+    }
+#else
+    (void)path;
+#endif
+}
+
+} // namespace detail
+
+
+// --- Lock policies ---
+//
+// A lock policy guards one bucket and must be default-constructible with
+// `lock()`/`unlock()`. Policies that also provide `lock_shared()`/
+// `unlock_shared()` let read-only operations share the bucket.
+
+/**
+ * @brief Minimalist SpinLock using CPU-relax hints.
+ *
+ * Uses `_mm_pause()` on x86/x64 to yield execution resources during
+ * busy-waiting, reducing power consumption and contention on hyper-threads.
+ * Falls back to a simple test-and-set loop if intrinsics are unavailable
+ * (though performance may degrade significantly under contention).
+ */
+struct SpinLock {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+    /** @brief Acquires the lock, spinning until successful. */
+    void lock() noexcept {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+            detail::cpu_relax();
+        }
+    }
+
+    /** @brief Acquires the lock only if it is free. */
+    bool try_lock() noexcept {
+        return !flag.test_and_set(std::memory_order_acquire);
+    }
+
+    /** @brief Releases the lock. */
+    void unlock() noexcept {
+        flag.clear(std::memory_order_release);
+    }
+
+    // Non-copyable and non-movable
+    SpinLock(const SpinLock&) = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+    SpinLock() = default; // Ensure default constructor is available
+};
+
+
+/**
+ * @brief Test-and-test-and-set spinlock with randomized exponential backoff.
+ *
+ * Unlike `SpinLock`, waiters spin on a plain load, which keeps the cache line
+ * shared instead of pulling it away from the owner on every iteration. The
+ * atomic exchange is only attempted once the lock looks free; a waiter that
+ * loses that race pauses for a random number of `_mm_pause()` calls drawn
+ * from a window that doubles each time, up to `kMaxBackoff`.
+ *
+ * @tparam kMaxBackoff Cap on the backoff window, in pause instructions.
+ */
+template <uint32_t kMaxBackoff = 1024>
+struct BackoffSpinLock {
+    static_assert(kMaxBackoff > 0, "BackoffSpinLock: kMaxBackoff must be positive.");
+
+    std::atomic<bool> locked{false};
+
+    /** @brief Acquires the lock, spinning until successful. */
+    void lock() noexcept {
+        if (!locked.exchange(true, std::memory_order_acquire)) return; // Uncontended fast path
+        uint32_t window = std::min<uint32_t>(kMinBackoff, kMaxBackoff);
+        for (;;) {
+            while (locked.load(std::memory_order_relaxed)) detail::cpu_relax();
+            if (!locked.exchange(true, std::memory_order_acquire)) return;
+            // Lost the race to another waiter: back off before looking again
+            for (uint32_t n = 1 + detail::thread_random() % window; n > 0; --n) detail::cpu_relax();
+            window = std::min(window * 2, kMaxBackoff);
+        }
+    }
+
+    /** @brief Acquires the lock only if it is free. */
+    bool try_lock() noexcept {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    /** @brief Releases the lock. */
+    void unlock() noexcept {
+        locked.store(false, std::memory_order_release);
+    }
+
+    // Non-copyable and non-movable
+    BackoffSpinLock(const BackoffSpinLock&) = delete;
+    BackoffSpinLock& operator=(const BackoffSpinLock&) = delete;
+    BackoffSpinLock() = default;
+
+private:
+    static constexpr uint32_t kMinBackoff = 4;
+};
+
+
+/**
+ * @brief Reader-writer spinlock admitting many readers or one writer.
+ *
+ * A single 16-bit word keeps the bucket within one cache line: a writer bit,
+ * a writer-pending bit and a 14-bit reader count (at most 16383 concurrent
+ * readers). A waiting writer sets the pending bit, which stops new readers
+ * from entering, so writers are not starved by a steady stream of lookups.
+ */
+struct RWSpinLock {
+    std::atomic<uint16_t> state{0};
+
+    /** @brief Acquires the lock exclusively. */
+    void lock() noexcept {
+        for (;;) {
+            uint16_t s = state.load(std::memory_order_relaxed);
+            if ((s & ~kWriterPending) == 0) {
+                // Free: take it, clearing our pending bit
+                if (state.compare_exchange_weak(s, kWriter, std::memory_order_acquire)) return;
+                continue;
+            }
+            if ((s & kWriterPending) == 0) state.fetch_or(kWriterPending, std::memory_order_relaxed);
+            detail::cpu_relax();
+        }
+    }
+
+    /** @brief Releases exclusive ownership. */
+    void unlock() noexcept {
+        state.fetch_and(static_cast<uint16_t>(~kWriter), std::memory_order_release);
+    }
+
+    /** @brief Acquires the lock shared with other readers. */
+    void lock_shared() noexcept {
+        for (;;) {
+            uint16_t s = state.load(std::memory_order_relaxed);
+            if ((s & (kWriter | kWriterPending)) == 0) {
+                if (state.compare_exchange_weak(s, static_cast<uint16_t>(s + 1), std::memory_order_acquire)) return;
+                continue;
+            }
+            detail::cpu_relax();
+        }
+    }
+
+    /** @brief Releases shared ownership. */
+    void unlock_shared() noexcept {
+        state.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Non-copyable and non-movable
+    RWSpinLock(const RWSpinLock&) = delete;
+    RWSpinLock& operator=(const RWSpinLock&) = delete;
+    RWSpinLock() = default;
+
+private:
+    static constexpr uint16_t kWriter = 0x8000;
+    static constexpr uint16_t kWriterPending = 0x4000;
+};
+
+
+/**
+ * @brief FIFO ticket lock.
+ *
+ * Each waiter takes the next ticket and spins until it is served, so the lock
+ * is granted strictly in arrival order and no thread can monopolize a hot
+ * bucket. Waiters only read while spinning and back off in proportion to
+ * their distance from the head of the queue. Two 16-bit counters (at most
+ * 65535 simultaneous waiters); with `FlatStorage` or `SwissStorage` the
+ * bucket stays within one cache line.
+ */
+struct TicketLock {
+    std::atomic<uint16_t> next_ticket{0};
+    std::atomic<uint16_t> now_serving{0};
+
+    /** @brief Acquires the lock in FIFO order. */
+    void lock() noexcept {
+        uint16_t ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+        for (;;) {
+            uint16_t serving = now_serving.load(std::memory_order_acquire);
+            if (serving == ticket) return;
+            // Proportional backoff: the further back in line, the longer the pause
+            for (uint16_t n = static_cast<uint16_t>(ticket - serving); n > 0; --n) detail::cpu_relax();
+        }
+    }
+
+    /** @brief Releases the lock to the next ticket holder. */
+    void unlock() noexcept {
+        now_serving.store(static_cast<uint16_t>(now_serving.load(std::memory_order_relaxed) + 1),
+                          std::memory_order_release);
+    }
+
+    // Non-copyable and non-movable
+    TicketLock(const TicketLock&) = delete;
+    TicketLock& operator=(const TicketLock&) = delete;
+    TicketLock() = default;
+};
+
+
+/**
+ * @brief MCS queue lock: FIFO, and each waiter spins on its own cache line.
+ *
+ * Waiters link per-thread queue nodes behind the tail pointer and spin on a
+ * flag in their own node, so a release touches only the successor's line
+ * instead of invalidating every waiter. Queue nodes come from a small
+ * thread-local pool (`kMaxHeldPerThread` MCS locks may be held at once by one
+ * thread), which keeps the standard `lock()`/`unlock()` interface.
+ *
+ * The lock is one pointer (8 bytes), so with the default storage a bucket
+ * spans two cache lines.
+ */
+struct McsLock {
+    static constexpr size_t kMaxHeldPerThread = 8;
+
+    /** @brief Acquires the lock in FIFO order. */
+    void lock() noexcept {
+        Node* me = claim_node();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->locked.store(true, std::memory_order_relaxed);
+        Node* predecessor = tail.exchange(me, std::memory_order_acq_rel);
+        if (predecessor != nullptr) {
+            predecessor->next.store(me, std::memory_order_release);
+            while (me->locked.load(std::memory_order_acquire)) detail::cpu_relax();
+        }
+    }
+
+    /** @brief Releases the lock, handing it to the next queued thread. */
+    void unlock() noexcept {
+        Node* me = owned_node();
+        Node* successor = me->next.load(std::memory_order_acquire);
+        if (successor == nullptr) {
+            Node* expected = me;
+            if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+                me->owner = nullptr;
+                return; // No waiters
+            }
+            // A waiter swapped itself in but has not linked yet
+            while ((successor = me->next.load(std::memory_order_acquire)) == nullptr) detail::cpu_relax();
+        }
+        successor->locked.store(false, std::memory_order_release);
+        me->owner = nullptr;
+    }
+
+    // Non-copyable and non-movable
+    McsLock(const McsLock&) = delete;
+    McsLock& operator=(const McsLock&) = delete;
+    McsLock() = default;
+
+private:
+    struct alignas(kCacheLineSize) Node {
+        std::atomic<Node*> next{nullptr};
+        std::atomic<bool> locked{false};
+        const McsLock* owner = nullptr; // Lock this node is queued on; thread-private
+    };
+
+    std::atomic<Node*> tail{nullptr};
+
+    static Node* thread_nodes() noexcept {
+        static thread_local Node nodes[kMaxHeldPerThread];
+        return nodes;
+    }
+
+    Node* claim_node() noexcept {
+        Node* nodes = thread_nodes();
+        for (size_t i = 0; i < kMaxHeldPerThread; ++i) {
+            if (nodes[i].owner == nullptr) {
+                nodes[i].owner = this;
+                return &nodes[i];
+            }
+        }
+        std::terminate(); // More than kMaxHeldPerThread MCS locks held by this thread
+    }
+
+    Node* owned_node() const noexcept {
+        Node* nodes = thread_nodes();
+        for (size_t i = 0; i < kMaxHeldPerThread; ++i) {
+            if (nodes[i].owner == this) return &nodes[i];
+        }
+        std::terminate(); // Unlocking a lock this thread does not hold
+    }
+};
+
+
+/**
+ * @brief Adaptive spin-then-park lock backed by a Linux futex.
+ *
+ * Spins with `_mm_pause()` for a bounded number of iterations, then sleeps
+ * in the kernel until the holder releases it, so a descheduled holder does
+ * not make waiters burn whole time slices. `unlock()` makes a system call
+ * only when some thread is parked. The spin budget adapts per lock like
+ * glibc's adaptive mutex: it tracks a moving average of how long recent
+ * acquisitions had to spin.
+ *
+ * A single 32-bit word holds the lock state (free / locked / locked with
+ * parked waiters) in its low bits and the spin estimate in its high half.
+ * Without futex support (non-Linux) parking degrades to yielding.
+ */
+struct FutexLock {
+    std::atomic<uint32_t> word{0};
+
+    /** @brief Acquires the lock, spinning briefly and then parking. */
+    void lock() noexcept {
+        uint32_t w = word.load(std::memory_order_relaxed);
+        if ((w & kStateMask) == kFree &&
+            word.compare_exchange_strong(w, w | kLocked, std::memory_order_acquire)) {
+            return; // Uncontended fast path
+        }
+
+        uint32_t estimate = w >> kSpinShift;
+        uint32_t budget = std::min<uint32_t>(kMaxSpins, estimate * 2 + kMinSpins);
+        for (uint32_t spins = 0; spins < budget; ++spins) {
+            detail::cpu_relax();
+            w = word.load(std::memory_order_relaxed);
+            if ((w & kStateMask) == kFree &&
+                word.compare_exchange_weak(w, w | kLocked, std::memory_order_acquire)) {
+                record_spins(spins);
+                return;
+            }
+        }
+
+        // Park. Once contended the word stays marked until the unlock that
+        // empties the queue, so every unlock in between wakes a waiter.
+        for (;;) {
+            w = word.load(std::memory_order_relaxed);
+            uint32_t contended = (w & ~kStateMask) | kContended;
+            if ((w & kStateMask) == kFree) {
+                if (word.compare_exchange_weak(w, contended, std::memory_order_acquire)) break;
+                continue;
+            }
+            if ((w & kStateMask) == kLocked &&
+                !word.compare_exchange_weak(w, contended, std::memory_order_relaxed)) {
+                continue;
+            }
+            detail::futex_wait(&word, contended);
+        }
+        record_spins(budget);
+    }
+
+    /** @brief Releases the lock, waking one parked waiter if any. */
+    void unlock() noexcept {
+        uint32_t previous = word.fetch_and(~kStateMask, std::memory_order_release);
+        if ((previous & kStateMask) == kContended) detail::futex_wake_one(&word);
+    }
+
+    // Non-copyable and non-movable
+    FutexLock(const FutexLock&) = delete;
+    FutexLock& operator=(const FutexLock&) = delete;
+    FutexLock() = default;
+
+private:
+    static constexpr uint32_t kFree = 0;
+    static constexpr uint32_t kLocked = 1;
+    static constexpr uint32_t kContended = 2; // Locked, with possible parked waiters
+    static constexpr uint32_t kStateMask = 3;
+    static constexpr unsigned kSpinShift = 16;
+    static constexpr uint32_t kMinSpins = 16;
+    static constexpr uint32_t kMaxSpins = 4096;
+
+    /** @brief Folds one acquisition's spin count into the estimate. Lock held. */
+    void record_spins(uint32_t spins) noexcept {
+        uint32_t w = word.load(std::memory_order_relaxed);
+        for (;;) {
+            int32_t estimate = static_cast<int32_t>(w >> kSpinShift);
+            estimate += (static_cast<int32_t>(spins) - estimate) / 8;
+            uint32_t updated = (w & kStateMask) | (static_cast<uint32_t>(estimate) << kSpinShift);
+            if (updated == w || word.compare_exchange_weak(w, updated, std::memory_order_relaxed)) return;
+        }
+    }
+};
+
+
+// --- Hash policies ---
+//
+// A hash policy maps a key to a size_t whose low bits select the bucket.
+// Policies are function objects with
+//   template <typename T> size_t operator()(const T&) const noexcept
+// and may carry state (e.g. a seed); VelocitySet stores a copy.
+
+/**
+ * @brief Uses the key itself (the default). Fastest, and ideal when the low
+ * bits of keys are already uniformly distributed (e.g. sequential IDs).
+ */
+struct IdentityHash {
+    template <typename T>
+    size_t operator()(const T& item) const noexcept {
+        // Cast to size_t for bitwise operation. Handles signed/unsigned T.
+        return static_cast<size_t>(item);
+    }
+};
+
+/**
+ * @brief Fibonacci multiply-shift: one multiplication by 2^64 / phi.
+ * The well-mixed high half of the product is rotated into the low bits
+ * used for bucket selection. Fixes strided keys (multiples of 4096).
+ */
+struct FibonacciHash {
+    template <typename T>
+    size_t operator()(const T& item) const noexcept {
+        uint64_t h = static_cast<uint64_t>(item) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>((h >> 32) | (h << 32));
+    }
+};
+
+/**
+ * @brief murmur3 fmix64 finalizer: every key bit affects every hash bit.
+ * Handles packed keys such as (shard << 48 | seq).
+ */
+struct Murmur3Hash {
+    template <typename T>
+    size_t operator()(const T& item) const noexcept {
+        return static_cast<size_t>(detail::mix_bits(static_cast<uint64_t>(item)));
+    }
+};
+
+/**
+ * @brief Keyed mixer with a random per-instance 128-bit seed, so bucket
+ * placement cannot be predicted by whoever chooses the keys. Protects
+ * against adversarial floods aimed at a single bucket lock.
+ */
+class SeededHash {
+public:
+    /** @brief Seeds from `std::random_device`. */
+    SeededHash() {
+        std::random_device rd;
+        seed_[0] = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+        seed_[1] = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+    }
+
+    /** @brief Uses an explicit seed (e.g. to reproduce a layout). */
+    SeededHash(uint64_t seed0, uint64_t seed1) noexcept : seed_{seed0, seed1} {}
+
+    template <typename T>
+    size_t operator()(const T& item) const noexcept {
+        uint64_t h = detail::mix_bits(static_cast<uint64_t>(item) ^ seed_[0]);
+        return static_cast<size_t>(detail::mix_bits(h ^ seed_[1]));
+    }
+
+    /** @brief Equal seeds place every key in the same bucket. */
+    bool operator==(const SeededHash& other) const noexcept {
+        return seed_[0] == other.seed_[0] && seed_[1] == other.seed_[1];
+    }
+
+private:
+    uint64_t seed_[2];
+};
+
+/**
+ * @brief Mixes only the key bits above the low 16, so all keys of one
+ * 65536-key chunk select the same bucket. Meant for `RoaringStorage`: each
+ * chunk's container then lives in exactly one bucket, under its lock.
+ */
+struct ChunkHash {
+    template <typename T>
+    size_t operator()(const T& item) const noexcept {
+        return static_cast<size_t>(detail::mix_bits(static_cast<uint64_t>(item) >> 16));
+    }
+};
+
+
+// --- Storage backends ---
+//
+// A storage backend is the per-bucket container, always accessed under the
+// bucket lock. It must be default-constructible, movable and provide:
+//   bool   insert(const T&)         - true if the item was newly added
+//   bool   erase(const T&)          - true if the item was present
+//   bool   contains(const T&) const
+//   void   clear()
+//   size_t size() const
+//   void   for_each(Fn&& fn) const      - calls fn(const T&) for every item
+//
+// A backend may additionally declare `static constexpr bool kOptimisticReads
+// = true` and provide `bool contains_optimistic(const T&) const noexcept`,
+// which must be safe to call concurrently with a writer (no data races, no
+// use-after-free, bounded probing). Its result is only trusted when the
+// bucket's version counter proves no writer overlapped the call.
+//
+// A backend may also provide `void prefetch(const T&) const noexcept`, a hint
+// that starts loading the memory a lookup of the item will touch. It is called
+// without the bucket lock, so like `contains_optimistic` it must tolerate a
+// concurrent writer; it must never dereference anything but the table header.
+//
+// A backend may declare `static constexpr size_t kDefaultMaxBucketLoad`, used
+// instead of the set's own default when it is constructed with max_bucket_load 0.
+
+/**
+ * @brief Node-based storage wrapping `std::unordered_set` (the default).
+ * @tparam T The integer key type.
+ */
+template <typename T>
+class UnorderedSetStorage {
+public:
+    bool insert(const T& item) { return set_.insert(item).second; }
+    bool erase(const T& item) { return set_.erase(item) > 0; }
+    bool contains(const T& item) const noexcept { return set_.count(item) > 0; }
+    void clear() noexcept { set_.clear(); }
+    size_t size() const noexcept { return set_.size(); }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const T& item : set_) fn(item);
+    }
+
+private:
+    std::unordered_set<T> set_;
+};
+
+/**
+ * @brief Open-addressing storage with linear probing over a flat key array.
+ *
+ * Keys live in one contiguous array next to a one-byte-per-slot control
+ * array (empty / full / tombstone), so lookups touch at most a couple of
+ * cache lines and inserts never allocate per key. `erase` leaves a tombstone
+ * that later inserts reuse; the table is rebuilt in place when tombstones
+ * pile up. Maximum load factor is 7/8.
+ *
+ * Slots are relaxed atomics (plain moves on x86) and a table that is
+ * outgrown is retired rather than freed, so `contains_optimistic` may run
+ * concurrently with a writer. Retired tables are released on destruction;
+ * as capacities double, they never add up to more than the live table.
+ * `clear` empties the live table in place for the same reason.
+ *
+ * @tparam T The integer key type.
+ */
+template <typename T>
+class FlatStorage {
+public:
+    static constexpr bool kOptimisticReads = true;
+
+    FlatStorage() = default;
+
+    FlatStorage(FlatStorage&& other) noexcept
+        : table_(other.table_.load(std::memory_order_relaxed)),
+          size_(other.size_),
+          tombstones_(other.tombstones_)
+    {
+        other.table_.store(nullptr, std::memory_order_relaxed);
+        other.size_ = other.tombstones_ = 0;
+    }
+
+    FlatStorage& operator=(FlatStorage&& other) noexcept {
+        if (this != &other) {
+            Table::destroy(table_.load(std::memory_order_relaxed));
+            table_.store(other.table_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            size_ = other.size_;
+            tombstones_ = other.tombstones_;
+            other.table_.store(nullptr, std::memory_order_relaxed);
+            other.size_ = other.tombstones_ = 0;
+        }
+        return *this;
+    }
+
+    FlatStorage(const FlatStorage&) = delete;
+    FlatStorage& operator=(const FlatStorage&) = delete;
+
+    ~FlatStorage() { Table::destroy(table_.load(std::memory_order_relaxed)); }
+
+    bool insert(const T& item) {
+        Table* table = table_.load(std::memory_order_relaxed);
+        size_t capacity = table ? table->capacity : 0;
+        if ((size_ + tombstones_ + 1) * 8 > capacity * 7) {
+            // Rebuild at the same size if tombstones are the problem
+            table = size_ * 2 + 2 > capacity ? grow() : purge_tombstones();
+            capacity = table->capacity;
+        }
+        size_t mask = capacity - 1;
+        size_t first_tombstone = capacity; // sentinel: none seen
+        for (size_t i = home_slot(item, mask);; i = (i + 1) & mask) {
+            uint8_t c = table->ctrl(i).load(std::memory_order_relaxed);
+            if (c == kFull) {
+                if (table->key(i).load(std::memory_order_relaxed) == item) return false;
+            } else if (c == kTombstone) {
+                if (first_tombstone == capacity) first_tombstone = i;
+            } else { // kEmpty: item is absent
+                if (first_tombstone != capacity) {
+                    i = first_tombstone;
+                    --tombstones_;
+                }
+                table->key(i).store(item, std::memory_order_relaxed);
+                table->ctrl(i).store(kFull, std::memory_order_relaxed);
+                ++size_;
+                return true;
+            }
+        }
+    }
+
+    bool erase(const T& item) noexcept {
+        Table* table = table_.load(std::memory_order_relaxed);
+        if (size_ == 0) return false;
+        size_t i = find_slot(table, item);
+        if (i == table->capacity) return false;
+        table->ctrl(i).store(kTombstone, std::memory_order_relaxed);
+        --size_;
+        ++tombstones_;
+        return true;
+    }
+
+    bool contains(const T& item) const noexcept {
+        if (size_ == 0) return false;
+        Table* table = table_.load(std::memory_order_relaxed);
+        return find_slot(table, item) != table->capacity;
+    }
+
+    bool contains_optimistic(const T& item) const noexcept {
+        Table* table = table_.load(std::memory_order_acquire);
+        return table != nullptr && find_slot(table, item) != table->capacity;
+    }
+
+    /** @brief Prefetches the home slot's key and control byte of item. */
+    void prefetch(const T& item) const noexcept {
+        Table* table = table_.load(std::memory_order_acquire);
+        if (table == nullptr) return;
+        size_t i = home_slot(item, table->capacity - 1);
+        detail::prefetch(&table->key(i));
+        detail::prefetch(&table->ctrl(i));
+    }
+
+    void clear() noexcept {
+        if (Table* table = table_.load(std::memory_order_relaxed)) table->reset();
+        size_ = 0;
+        tombstones_ = 0;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        Table* table = table_.load(std::memory_order_relaxed);
+        if (size_ == 0) return;
+        for (size_t i = 0; i < table->capacity; ++i) {
+            if (table->ctrl(i).load(std::memory_order_relaxed) == kFull) {
+                fn(static_cast<const T&>(table->key(i).load(std::memory_order_relaxed)));
+            }
+        }
+    }
+
+private:
+    enum : uint8_t { kEmpty = 0, kFull = 1, kTombstone = 2 };
+    static constexpr size_t kMinCapacity = 8; // Must be a power of two
+
+    /** @brief Header of one allocation holding `capacity` keys then control bytes. */
+    struct Table {
+        size_t capacity; // Always a power of two
+        Table* retired;  // Outgrown predecessor, kept alive for optimistic readers
+
+        std::atomic<T>& key(size_t i) noexcept {
+            return reinterpret_cast<std::atomic<T>*>(this + 1)[i];
+        }
+        std::atomic<uint8_t>& ctrl(size_t i) noexcept {
+            return reinterpret_cast<std::atomic<uint8_t>*>(&key(capacity))[i];
+        }
+
+        void reset() noexcept {
+            for (size_t i = 0; i < capacity; ++i) ctrl(i).store(kEmpty, std::memory_order_relaxed);
+        }
+
+        static Table* create(size_t capacity, Table* retired) {
+            static_assert(alignof(Table) >= alignof(std::atomic<T>), "key array must follow the header aligned");
+            void* raw = ::operator new(sizeof(Table) + capacity * (sizeof(std::atomic<T>) + 1));
+            Table* table = new (raw) Table{capacity, retired};
+            for (size_t i = 0; i < capacity; ++i) {
+                new (&table->key(i)) std::atomic<T>(T{});
+                new (&table->ctrl(i)) std::atomic<uint8_t>(kEmpty);
+            }
+            return table;
+        }
+
+        static void destroy(Table* table) noexcept {
+            while (table != nullptr) {
+                Table* retired = table->retired;
+                ::operator delete(table);
+                table = retired;
+            }
+        }
+    };
+
+    std::atomic<Table*> table_{nullptr};
+    size_t size_ = 0;
+    size_t tombstones_ = 0;
+
+    static size_t home_slot(const T& item, size_t mask) noexcept {
+        return static_cast<size_t>(detail::slot_hash(static_cast<uint64_t>(item))) & mask;
+    }
+
+    /**
+     * @brief Returns the slot holding item, or table->capacity if absent.
+     * Probing is bounded by the capacity so that a torn optimistic read can
+     * never loop forever.
+     */
+    static size_t find_slot(Table* table, const T& item) noexcept {
+        size_t capacity = table->capacity;
+        size_t mask = capacity - 1;
+        size_t i = home_slot(item, mask);
+        for (size_t probes = 0; probes < capacity; ++probes, i = (i + 1) & mask) {
+            uint8_t c = table->ctrl(i).load(std::memory_order_relaxed);
+            if (c == kEmpty) break;
+            if (c == kFull && table->key(i).load(std::memory_order_relaxed) == item) return i;
+        }
+        return capacity;
+    }
+
+    static void place(Table* table, const T& item) noexcept {
+        size_t mask = table->capacity - 1;
+        size_t i = home_slot(item, mask);
+        while (table->ctrl(i).load(std::memory_order_relaxed) != kEmpty) i = (i + 1) & mask;
+        table->key(i).store(item, std::memory_order_relaxed);
+        table->ctrl(i).store(kFull, std::memory_order_relaxed);
+    }
+
+    /** @brief Moves all keys into a table of twice the capacity and retires the old one. */
+    Table* grow() {
+        Table* old_table = table_.load(std::memory_order_relaxed);
+        size_t old_capacity = old_table ? old_table->capacity : 0;
+        Table* table = Table::create(old_capacity == 0 ? kMinCapacity : old_capacity * 2, old_table);
+        for (size_t j = 0; j < old_capacity; ++j) {
+            if (old_table->ctrl(j).load(std::memory_order_relaxed) == kFull) {
+                place(table, old_table->key(j).load(std::memory_order_relaxed));
+            }
+        }
+        table_.store(table, std::memory_order_release);
+        tombstones_ = 0;
+        return table;
+    }
+
+    /** @brief Rebuilds the current table in place without its tombstones. */
+    Table* purge_tombstones() {
+        Table* table = table_.load(std::memory_order_relaxed);
+        std::vector<T> live;
+        live.reserve(size_);
+        for (size_t j = 0; j < table->capacity; ++j) {
+            if (table->ctrl(j).load(std::memory_order_relaxed) == kFull) {
+                live.push_back(table->key(j).load(std::memory_order_relaxed));
+            }
+        }
+        table->reset();
+        for (const T& item : live) place(table, item);
+        tombstones_ = 0;
+        return table;
+    }
+};
+
+/**
+ * @brief SwissTable-style storage probing a whole group of slots per compare.
+ *
+ * Every slot has a control byte holding a 7-bit fingerprint of its key (or an
+ * empty/deleted marker). Lookups load one `detail::ControlGroup` of control
+ * bytes, compare all fingerprints at once with SIMD and only touch the key
+ * array for fingerprint hits. A miss usually ends after the first group since
+ * it already contains an empty slot. Groups are probed quadratically.
+ *
+ * `erase` marks a slot empty when its group still has an empty slot (no probe
+ * sequence can have passed through it), and deleted otherwise.
+ *
+ * @tparam T The integer key type.
+ */
+template <typename T>
+class SwissStorage {
+    using Group = detail::ControlGroup;
+
+public:
+    SwissStorage() = default;
+
+    SwissStorage(SwissStorage&& other) noexcept
+        : keys_(std::move(other.keys_)),
+          ctrl_(std::move(other.ctrl_)),
+          capacity_(other.capacity_),
+          size_(other.size_),
+          deleted_(other.deleted_)
+    {
+        other.capacity_ = other.size_ = other.deleted_ = 0;
+    }
+
+    SwissStorage& operator=(SwissStorage&& other) noexcept {
+        if (this != &other) {
+            keys_ = std::move(other.keys_);
+            ctrl_ = std::move(other.ctrl_);
+            capacity_ = other.capacity_;
+            size_ = other.size_;
+            deleted_ = other.deleted_;
+            other.capacity_ = other.size_ = other.deleted_ = 0;
+        }
+        return *this;
+    }
+
+    SwissStorage(const SwissStorage&) = delete;
+    SwissStorage& operator=(const SwissStorage&) = delete;
+
+    bool insert(const T& item) {
+        uint64_t hash = hash_of(item);
+        if (find_slot(item, hash) != capacity_) return false;
+        if ((size_ + deleted_ + 1) * 8 > capacity_ * 7) {
+            // Rebuild at the same size if deleted markers are the problem
+            rehash(size_ * 2 + 2 > capacity_ ? grown_capacity() : capacity_);
+        }
+        size_t i = find_free_slot(hash);
+        if (ctrl_[i] == Group::kDeleted) --deleted_;
+        keys_[i] = item;
+        ctrl_[i] = fingerprint(hash);
+        ++size_;
+        return true;
+    }
+
+    bool erase(const T& item) noexcept {
+        size_t i = find_slot(item, hash_of(item));
+        if (i == capacity_) return false;
+        Group group(&ctrl_[i & ~(Group::kWidth - 1)]);
+        if (group.match_empty() != 0) {
+            ctrl_[i] = Group::kEmpty;
+        } else {
+            ctrl_[i] = Group::kDeleted;
+            ++deleted_;
+        }
+        --size_;
+        return true;
+    }
+
+    bool contains(const T& item) const noexcept {
+        return find_slot(item, hash_of(item)) != capacity_;
+    }
+
+    void clear() noexcept {
+        if (capacity_ != 0) std::memset(ctrl_.get(), Group::kEmpty, capacity_);
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t i = 0; i < capacity_ && size_ != 0; ++i) {
+            if ((ctrl_[i] & 0x80) == 0) fn(static_cast<const T&>(keys_[i]));
+        }
+    }
+
+private:
+    std::unique_ptr<T[]> keys_;
+    std::unique_ptr<uint8_t[]> ctrl_;
+    size_t capacity_ = 0; // Zero or a power-of-two multiple of Group::kWidth
+    size_t size_ = 0;
+    size_t deleted_ = 0;
+
+    static uint64_t hash_of(const T& item) noexcept {
+        return detail::slot_hash(static_cast<uint64_t>(item));
+    }
+
+    static uint8_t fingerprint(uint64_t hash) noexcept {
+        return static_cast<uint8_t>(hash & 0x7F);
+    }
+
+    size_t first_group(uint64_t hash) const noexcept {
+        return static_cast<size_t>(hash >> 7) & (capacity_ / Group::kWidth - 1);
+    }
+
+    size_t grown_capacity() const noexcept {
+        return capacity_ == 0 ? Group::kWidth : capacity_ * 2;
+    }
+
+    /** @brief Returns the slot holding item, or capacity_ if absent. */
+    size_t find_slot(const T& item, uint64_t hash) const noexcept {
+        if (size_ == 0) return capacity_;
+        size_t group_mask = capacity_ / Group::kWidth - 1;
+        uint8_t h2 = fingerprint(hash);
+        // Triangular steps visit every group; the load factor cap guarantees
+        // some group with an empty slot ends the probe.
+        for (size_t g = first_group(hash), step = 1;; g = (g + step++) & group_mask) {
+            size_t base = g * Group::kWidth;
+            Group group(&ctrl_[base]);
+            for (uint32_t m = group.match(h2); m != 0; m &= m - 1) {
+                size_t i = base + detail::count_trailing_zeros(m);
+                if (keys_[i] == item) return i;
+            }
+            if (group.match_empty() != 0) return capacity_;
+        }
+    }
+
+    /** @brief Returns the first empty or deleted slot on the probe sequence. */
+    size_t find_free_slot(uint64_t hash) const noexcept {
+        size_t group_mask = capacity_ / Group::kWidth - 1;
+        for (size_t g = first_group(hash), step = 1;; g = (g + step++) & group_mask) {
+            size_t base = g * Group::kWidth;
+            uint32_t m = Group(&ctrl_[base]).match_empty_or_deleted();
+            if (m != 0) return base + detail::count_trailing_zeros(m);
+        }
+    }
+
+    void rehash(size_t new_capacity) {
+        std::unique_ptr<T[]> old_keys = std::move(keys_);
+        std::unique_ptr<uint8_t[]> old_ctrl = std::move(ctrl_);
+        size_t old_capacity = capacity_;
+
+        keys_.reset(new T[new_capacity]);
+        ctrl_.reset(new uint8_t[new_capacity]);
+        std::memset(ctrl_.get(), Group::kEmpty, new_capacity);
+        capacity_ = new_capacity;
+        deleted_ = 0;
+
+        for (size_t j = 0; j < old_capacity; ++j) {
+            if (old_ctrl[j] & 0x80) continue; // Empty or deleted
+            uint64_t hash = hash_of(old_keys[j]);
+            size_t i = find_free_slot(hash);
+            keys_[i] = old_keys[j];
+            ctrl_[i] = fingerprint(hash);
+        }
+    }
+};
+
+
+/**
+ * @brief Storage that picks its representation from the bucket's occupancy.
+ *
+ * - Up to `kInlineCapacity` keys (10 32-bit or 5 64-bit keys): a sorted
+ *   array inside the storage object itself, so a small bucket needs no
+ *   allocation and stays within its own cache line.
+ * - More keys: a `SwissStorage` table.
+ * - Keys packed into a narrow range: a bitmap over [base, base + 64 * words),
+ *   used whenever it costs no more bits than the keys themselves would
+ *   (8 * sizeof(T) per key).
+ *
+ * A full inline array promotes on its next new key, to a bitmap if the keys
+ * are dense and a table otherwise. A table checks for density each time its
+ * size doubles. A bitmap extends its range for a new key while still dense,
+ * and demotes to a table when it is not, or when erasures leave it four
+ * times over budget. Tables and bitmaps shrink back to the inline array at
+ * half its capacity. The object is 48 bytes, so a 64-byte `Bucket` holds it
+ * with any lock policy.
+ *
+ * @tparam T The integer key type.
+ */
+template <typename T>
+class AdaptiveStorage {
+public:
+    AdaptiveStorage() noexcept {}
+
+    AdaptiveStorage(AdaptiveStorage&& other) noexcept { take(other); }
+
+    AdaptiveStorage& operator=(AdaptiveStorage&& other) noexcept {
+        if (this != &other) {
+            destroy_rep();
+            take(other);
+        }
+        return *this;
+    }
+
+    AdaptiveStorage(const AdaptiveStorage&) = delete;
+    AdaptiveStorage& operator=(const AdaptiveStorage&) = delete;
+
+    ~AdaptiveStorage() { destroy_rep(); }
+
+    bool insert(const T& item) {
+        if (mode_ == Mode::kInline) return insert_inline(item);
+        if (mode_ == Mode::kBitmap) return insert_bitmap(item);
+        if (!rep_.table.insert(item)) return false;
+        ++size_;
+        if (size_ >= 2 * kInlineCapacity && (size_ & (size_ - 1)) == 0) {
+            T low, high;
+            bounds(low, high);
+            if (dense_enough(low, high, size_)) {
+                try {
+                    to_bitmap(low, high, 0);
+                } catch (...) {
+                    // Out of memory: the table is still correct
+                }
+            }
+        }
+        return true;
+    }
+
+    bool erase(const T& item) noexcept {
+        if (mode_ == Mode::kInline) {
+            T* keys = rep_.keys;
+            T* end = keys + size_;
+            T* pos = std::lower_bound(keys, end, item);
+            if (pos == end || *pos != item) return false;
+            std::copy(pos + 1, end, pos);
+            --size_;
+            return true;
+        }
+        if (mode_ == Mode::kBitmap) {
+            uint64_t offset;
+            if (!bitmap_offset(item, offset)) return false;
+            uint64_t mask = uint64_t{1} << (offset & 63);
+            uint64_t& word = rep_.bitmap.bits[offset >> 6];
+            if ((word & mask) == 0) return false;
+            word &= ~mask;
+        } else if (!rep_.table.erase(item)) {
+            return false;
+        }
+        --size_;
+        if (size_ <= kInlineCapacity / 2) {
+            to_inline();
+        } else if (mode_ == Mode::kBitmap &&
+                   uint64_t{rep_.bitmap.words} * 64 > 4 * kBitsPerKey * uint64_t{size_}) {
+            try {
+                to_table();
+            } catch (...) {
+                // Out of memory: a sparse bitmap is still correct
+            }
+        }
+        return true;
+    }
+
+    bool contains(const T& item) const noexcept {
+        if (mode_ == Mode::kInline) {
+            for (uint32_t i = 0; i < size_; ++i) {
+                if (rep_.keys[i] >= item) return rep_.keys[i] == item; // Sorted
+            }
+            return false;
+        }
+        if (mode_ == Mode::kBitmap) {
+            uint64_t offset;
+            return bitmap_offset(item, offset) && ((rep_.bitmap.bits[offset >> 6] >> (offset & 63)) & 1);
+        }
+        return rep_.table.contains(item);
+    }
+
+    void clear() noexcept {
+        destroy_rep();
+        size_ = 0;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        if (mode_ == Mode::kInline) {
+            for (uint32_t i = 0; i < size_; ++i) fn(static_cast<const T&>(rep_.keys[i]));
+        } else if (mode_ == Mode::kBitmap) {
+            const Bitmap& bitmap = rep_.bitmap;
+            for (uint32_t w = 0; w < bitmap.words; ++w) {
+                for (uint64_t word = bitmap.bits[w]; word != 0; word &= word - 1) {
+                    uint64_t offset = uint64_t{w} * 64 + detail::count_trailing_zeros64(word);
+                    T item = static_cast<T>(static_cast<uint64_t>(bitmap.base) + offset);
+                    fn(static_cast<const T&>(item));
+                }
+            }
+        } else {
+            rep_.table.for_each(fn);
+        }
+    }
+
+private:
+    enum class Mode : uint8_t { kInline, kTable, kBitmap };
+    static constexpr size_t kInlineBytes = 40; // Leaves a 64-byte Bucket room for its lock and counters
+    static constexpr size_t kInlineCapacity = kInlineBytes / sizeof(T);
+    static constexpr uint64_t kBitsPerKey = 8 * sizeof(T); // A bitmap may spend this many bits per key
+
+    /** @brief Bits for keys [base, base + 64 * words); owned, allocated with new[]. */
+    struct Bitmap {
+        uint64_t* bits;
+        T base;
+        uint32_t words;
+    };
+
+    union Rep {
+        T keys[kInlineCapacity]; // Sorted; the first size_ are valid
+        SwissStorage<T> table;
+        Bitmap bitmap;
+
+        Rep() noexcept {}
+        ~Rep() {}
+    };
+    static_assert(sizeof(SwissStorage<T>) <= kInlineBytes, "SwissStorage must fit in the inline area");
+
+    Rep rep_;
+    uint32_t size_ = 0;
+    Mode mode_ = Mode::kInline;
+
+    /** @brief Whether a bitmap over [low, high] stays within budget for count keys. */
+    static bool dense_enough(const T& low, const T& high, uint64_t count) noexcept {
+        return static_cast<uint64_t>(high) - static_cast<uint64_t>(low) < kBitsPerKey * count;
+    }
+
+    /** @brief Bit position of item in the bitmap; false if outside its range. */
+    bool bitmap_offset(const T& item, uint64_t& offset) const noexcept {
+        if (item < rep_.bitmap.base) return false;
+        offset = static_cast<uint64_t>(item) - static_cast<uint64_t>(rep_.bitmap.base);
+        return offset < uint64_t{rep_.bitmap.words} * 64;
+    }
+
+    /** @brief Smallest and largest key. Requires size_ > 0. */
+    void bounds(T& low, T& high) const noexcept {
+        low = std::numeric_limits<T>::max();
+        high = std::numeric_limits<T>::min();
+        for_each([&](const T& item) {
+            low = std::min(low, item);
+            high = std::max(high, item);
+        });
+    }
+
+    bool insert_inline(const T& item) {
+        T* keys = rep_.keys;
+        T* end = keys + size_;
+        T* pos = std::lower_bound(keys, end, item);
+        if (pos != end && *pos == item) return false;
+        if (size_ < kInlineCapacity) {
+            std::copy_backward(pos, end, end + 1);
+            *pos = item;
+            ++size_;
+            return true;
+        }
+        T low = std::min(keys[0], item);
+        T high = std::max(keys[size_ - 1], item);
+        if (dense_enough(low, high, uint64_t{size_} + 1)) {
+            to_bitmap(low, high, 0);
+            return insert_bitmap(item);
+        }
+        to_table();
+        return insert(item);
+    }
+
+    bool insert_bitmap(const T& item) {
+        Bitmap& bitmap = rep_.bitmap;
+        uint64_t offset;
+        if (bitmap_offset(item, offset)) {
+            uint64_t mask = uint64_t{1} << (offset & 63);
+            uint64_t& word = bitmap.bits[offset >> 6];
+            if (word & mask) return false;
+            word |= mask;
+            ++size_;
+            return true;
+        }
+        T low, high;
+        bounds(low, high);
+        low = std::min(low, item);
+        high = std::max(high, item);
+        if (dense_enough(low, high, uint64_t{size_} + 1)) {
+            // Leave headroom on the side being extended, so runs of ascending or
+            // descending IDs do not rebuild the bitmap on every word
+            uint64_t spare = uint64_t{bitmap.words / 2} * 64;
+            if (item < bitmap.base) {
+                uint64_t room = static_cast<uint64_t>(low) - static_cast<uint64_t>(std::numeric_limits<T>::min());
+                low = static_cast<T>(static_cast<uint64_t>(low) - std::min(spare, room));
+                spare = 0;
+            }
+            to_bitmap(low, high, static_cast<uint32_t>(spare / 64));
+            return insert_bitmap(item);
+        }
+        to_table();
+        return insert(item);
+    }
+
+    /** @brief Rebuilds the contents as a bitmap over [low, high] plus spare words. */
+    void to_bitmap(const T& low, const T& high, uint32_t spare_words) {
+        uint64_t span = static_cast<uint64_t>(high) - static_cast<uint64_t>(low);
+        uint32_t words = static_cast<uint32_t>(span / 64 + 1) + spare_words;
+        Bitmap bitmap{new uint64_t[words](), low, words};
+        for_each([&](const T& item) {
+            uint64_t offset = static_cast<uint64_t>(item) - static_cast<uint64_t>(low);
+            bitmap.bits[offset >> 6] |= uint64_t{1} << (offset & 63);
+        });
+        destroy_rep();
+        rep_.bitmap = bitmap;
+        mode_ = Mode::kBitmap;
+    }
+
+    void to_table() {
+        SwissStorage<T> table;
+        for_each([&](const T& item) { table.insert(item); });
+        destroy_rep();
+        new (&rep_.table) SwissStorage<T>(std::move(table));
+        mode_ = Mode::kTable;
+    }
+
+    /** @brief Moves the keys back inline. Requires size_ <= kInlineCapacity. */
+    void to_inline() noexcept {
+        T keys[kInlineCapacity];
+        size_t count = 0;
+        for_each([&](const T& item) {
+            size_t i = count++;
+            for (; i > 0 && keys[i - 1] > item; --i) keys[i] = keys[i - 1]; // Insertion sort
+            keys[i] = item;
+        });
+        destroy_rep();
+        std::copy(keys, keys + count, rep_.keys);
+    }
+
+    /** @brief Frees the table or bitmap, if any, leaving an inline array. */
+    void destroy_rep() noexcept {
+        if (mode_ == Mode::kTable) {
+            rep_.table.~SwissStorage<T>();
+        } else if (mode_ == Mode::kBitmap) {
+            delete[] rep_.bitmap.bits;
+        }
+        mode_ = Mode::kInline;
+    }
+
+    /** @brief Moves other's contents into this (whose rep must be free), emptying other. */
+    void take(AdaptiveStorage& other) noexcept {
+        if (other.mode_ == Mode::kInline) {
+            std::copy(other.rep_.keys, other.rep_.keys + other.size_, rep_.keys);
+        } else if (other.mode_ == Mode::kTable) {
+            new (&rep_.table) SwissStorage<T>(std::move(other.rep_.table));
+        } else {
+            rep_.bitmap = other.rep_.bitmap;
+            other.rep_.bitmap.bits = nullptr;
+        }
+        mode_ = other.mode_;
+        size_ = other.size_;
+        other.destroy_rep();
+        other.size_ = 0;
+    }
+};
+
+/**
+ * @brief Compressed storage in the style of Roaring bitmaps.
+ *
+ * Keys are split into a chunk number (the bits above the low 16) and a
+ * 16-bit offset. Each chunk present in the bucket has one container:
+ * - array: sorted offsets, 2 bytes per key, for up to 4096 keys;
+ * - bitmap: 65536 bits (8 KB) for a crowded chunk;
+ * - run: sorted (start, length - 1) pairs, 4 bytes per run of consecutive keys.
+ *
+ * Each container converts to the smallest kind at a few checkpoints:
+ * - an array or bitmap re-counts its runs when its size reaches a power of two;
+ * - an array converts when it outgrows 4096 keys;
+ * - a bitmap converts at half that, so a chunk hovering around 4096 keys
+ *   does not flip back and forth;
+ * - a run container converts once it is twice the size of the alternative.
+ * Lookups are a binary search over the bucket's few chunks, then one probe
+ * of the container.
+ *
+ * Use with `ChunkHash`, so that every key of a chunk lands in the same bucket
+ * and each chunk has a single container guarded by the bucket lock. The
+ * default bucket load is one full chunk.
+ *
+ * @tparam T The integer key type.
+ */
+template <typename T>
+class RoaringStorage {
+public:
+    static constexpr size_t kDefaultMaxBucketLoad = size_t{1} << 16; // One full chunk per bucket
+
+    RoaringStorage() = default;
+
+    RoaringStorage(RoaringStorage&& other) noexcept
+        : containers_(std::move(other.containers_)), size_(other.size_)
+    {
+        other.containers_.clear();
+        other.size_ = 0;
+    }
+
+    RoaringStorage& operator=(RoaringStorage&& other) noexcept {
+        if (this != &other) {
+            containers_ = std::move(other.containers_);
+            size_ = other.size_;
+            other.containers_.clear();
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    RoaringStorage(const RoaringStorage&) = delete;
+    RoaringStorage& operator=(const RoaringStorage&) = delete;
+
+    bool insert(const T& item) {
+        uint64_t key = static_cast<uint64_t>(item);
+        uint64_t high = key >> kChunkBits;
+        uint16_t low = static_cast<uint16_t>(key);
+        auto it = find_chunk(high);
+        if (it == containers_.end() || it->high != high) {
+            Container container;
+            container.high = high;
+            container.values.push_back(low);
+            container.cardinality = 1;
+            containers_.insert(it, std::move(container));
+        } else if (!add(*it, low)) {
+            return false;
+        }
+        ++size_;
+        return true;
+    }
+
+    bool erase(const T& item) {
+        uint64_t key = static_cast<uint64_t>(item);
+        uint64_t high = key >> kChunkBits;
+        auto it = find_chunk(high);
+        if (it == containers_.end() || it->high != high) return false;
+        if (!remove(*it, static_cast<uint16_t>(key))) return false;
+        if (it->cardinality == 0) containers_.erase(it);
+        --size_;
+        return true;
+    }
+
+    bool contains(const T& item) const noexcept {
+        uint64_t key = static_cast<uint64_t>(item);
+        uint64_t high = key >> kChunkBits;
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), high,
+                                   [](const Container& c, uint64_t h) { return c.high < h; });
+        return it != containers_.end() && it->high == high && contains_low(*it, static_cast<uint16_t>(key));
+    }
+
+    void clear() noexcept {
+        containers_.clear();
+        size_ = 0;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const Container& container : containers_) {
+            uint64_t base = container.high << kChunkBits;
+            for_each_low(container, [&](uint32_t low) {
+                T item = static_cast<T>(base | low);
+                fn(static_cast<const T&>(item));
+            });
+        }
+    }
+
+private:
+    enum class Kind : uint8_t { kArray, kBitmap, kRun };
+    static constexpr unsigned kChunkBits = 16;
+    static constexpr size_t kArrayMax = 4096;          // Keys; an array this full is as large as a bitmap
+    static constexpr size_t kBitmapWords = 1024;       // 65536 bits
+    static constexpr size_t kBitmapBytes = kBitmapWords * 8;
+    static constexpr uint32_t kRecountMin = 32;        // Smallest array size at which runs are counted
+
+    struct Container {
+        uint64_t high = 0;                // Chunk number: key >> 16
+        std::vector<uint16_t> values;     // kArray: sorted offsets; kRun: (start, length - 1) pairs
+        std::unique_ptr<uint64_t[]> bits; // kBitmap only
+        uint32_t cardinality = 0;
+        Kind kind = Kind::kArray;
+    };
+
+    std::vector<Container> containers_; // Sorted by high
+    size_t size_ = 0;
+
+    typename std::vector<Container>::iterator find_chunk(uint64_t high) {
+        return std::lower_bound(containers_.begin(), containers_.end(), high,
+                                [](const Container& c, uint64_t h) { return c.high < h; });
+    }
+
+    /** @brief Index of the last run starting at or before low, or the run count if none. */
+    static size_t find_run(const Container& c, uint32_t low) noexcept {
+        size_t runs = c.values.size() / 2;
+        size_t first = 0, last = runs;
+        while (first < last) {
+            size_t mid = (first + last) / 2;
+            if (c.values[2 * mid] <= low) {
+                first = mid + 1;
+            } else {
+                last = mid;
+            }
+        }
+        return first == 0 ? runs : first - 1;
+    }
+
+    static bool contains_low(const Container& c, uint16_t low) noexcept {
+        if (c.kind == Kind::kArray) return std::binary_search(c.values.begin(), c.values.end(), low);
+        if (c.kind == Kind::kBitmap) return (c.bits[low >> 6] >> (low & 63)) & 1;
+        size_t r = find_run(c, low);
+        return r != c.values.size() / 2 && low - c.values[2 * r] <= c.values[2 * r + 1];
+    }
+
+    /** @brief Calls fn(offset) for every key of the container, in increasing order. */
+    template <typename Fn>
+    static void for_each_low(const Container& c, Fn&& fn) {
+        if (c.kind == Kind::kArray) {
+            for (uint16_t low : c.values) fn(uint32_t{low});
+        } else if (c.kind == Kind::kBitmap) {
+            for (size_t w = 0; w < kBitmapWords; ++w) {
+                for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+                    fn(static_cast<uint32_t>(w * 64 + detail::count_trailing_zeros64(word)));
+                }
+            }
+        } else {
+            for (size_t r = 0; r < c.values.size(); r += 2) {
+                uint32_t start = c.values[r];
+                for (uint32_t low = start; low <= start + c.values[r + 1]; ++low) fn(low);
+            }
+        }
+    }
+
+    static bool add(Container& c, uint16_t low) {
+        if (c.kind == Kind::kArray) {
+            auto pos = std::lower_bound(c.values.begin(), c.values.end(), low);
+            if (pos != c.values.end() && *pos == low) return false;
+            c.values.insert(pos, low);
+            ++c.cardinality;
+            if (c.cardinality > kArrayMax || (c.cardinality >= kRecountMin && is_pow2(c.cardinality))) {
+                optimize(c);
+            }
+            return true;
+        }
+        if (c.kind == Kind::kBitmap) {
+            uint64_t mask = uint64_t{1} << (low & 63);
+            uint64_t& word = c.bits[low >> 6];
+            if (word & mask) return false;
+            word |= mask;
+            ++c.cardinality;
+            if (is_pow2(c.cardinality)) optimize(c);
+            return true;
+        }
+        size_t runs = c.values.size() / 2;
+        size_t r = find_run(c, low);
+        if (r != runs) {
+            uint32_t end = uint32_t{c.values[2 * r]} + c.values[2 * r + 1];
+            if (low <= end) return false;
+            if (low == end + 1) {
+                ++c.values[2 * r + 1];
+                if (r + 1 < runs && c.values[2 * r + 2] == low + 1) {
+                    // Closes the gap to the next run: merge
+                    c.values[2 * r + 1] = static_cast<uint16_t>(c.values[2 * r + 1] + c.values[2 * r + 3] + 1);
+                    c.values.erase(c.values.begin() + 2 * r + 2, c.values.begin() + 2 * r + 4);
+                }
+                ++c.cardinality;
+                return true;
+            }
+        }
+        size_t next = r == runs ? 0 : r + 1;
+        if (next < runs && c.values[2 * next] == low + 1) {
+            --c.values[2 * next];
+            ++c.values[2 * next + 1];
+        } else {
+            uint16_t run[2] = {low, 0};
+            c.values.insert(c.values.begin() + 2 * next, run, run + 2);
+        }
+        ++c.cardinality;
+        if (fragmented(c)) optimize(c);
+        return true;
+    }
+
+    static bool remove(Container& c, uint16_t low) {
+        if (c.kind == Kind::kArray) {
+            auto pos = std::lower_bound(c.values.begin(), c.values.end(), low);
+            if (pos == c.values.end() || *pos != low) return false;
+            c.values.erase(pos);
+            --c.cardinality;
+            return true;
+        }
+        if (c.kind == Kind::kBitmap) {
+            uint64_t mask = uint64_t{1} << (low & 63);
+            uint64_t& word = c.bits[low >> 6];
+            if ((word & mask) == 0) return false;
+            word &= ~mask;
+            --c.cardinality;
+            if (c.cardinality <= kArrayMax / 2) optimize(c);
+            return true;
+        }
+        size_t runs = c.values.size() / 2;
+        size_t r = find_run(c, low);
+        if (r == runs) return false;
+        uint32_t start = c.values[2 * r];
+        uint32_t end = start + c.values[2 * r + 1];
+        if (low > end) return false;
+        if (start == end) {
+            c.values.erase(c.values.begin() + 2 * r, c.values.begin() + 2 * r + 2);
+        } else if (low == start) {
+            ++c.values[2 * r];
+            --c.values[2 * r + 1];
+        } else if (low == end) {
+            --c.values[2 * r + 1];
+        } else {
+            // Split [start, end] around low
+            uint16_t run[2] = {static_cast<uint16_t>(low + 1), static_cast<uint16_t>(end - low - 1)};
+            c.values.insert(c.values.begin() + 2 * r + 2, run, run + 2);
+            c.values[2 * r + 1] = static_cast<uint16_t>(low - 1 - start);
+        }
+        --c.cardinality;
+        if (c.cardinality != 0 && fragmented(c)) optimize(c);
+        return true;
+    }
+
+    static bool is_pow2(uint32_t n) noexcept { return (n & (n - 1)) == 0; }
+
+    /** @brief Whether a run container has become twice as large as an array or bitmap. */
+    static bool fragmented(const Container& c) noexcept {
+        size_t runs = c.values.size() / 2;
+        return bytes(c, Kind::kRun, runs) > 2 * std::min(bytes(c, Kind::kArray, runs), kBitmapBytes);
+    }
+
+    /** @brief Memory a container of this cardinality and run count takes as kind. */
+    static size_t bytes(const Container& c, Kind kind, size_t runs) noexcept {
+        if (kind == Kind::kArray) return c.cardinality <= kArrayMax ? 2 * size_t{c.cardinality}
+                                                                 : std::numeric_limits<size_t>::max();
+        if (kind == Kind::kBitmap) return kBitmapBytes;
+        return 4 * runs;
+    }
+
+    static size_t count_runs(const Container& c) noexcept {
+        if (c.kind == Kind::kRun) return c.values.size() / 2;
+        size_t runs = 0;
+        if (c.kind == Kind::kArray) {
+            for (size_t i = 0; i < c.values.size(); ++i) {
+                runs += i == 0 || c.values[i] != c.values[i - 1] + 1;
+            }
+        } else {
+            uint64_t carry = 0; // Top bit of the previous word
+            for (size_t w = 0; w < kBitmapWords; ++w) {
+                uint64_t word = c.bits[w];
+                runs += detail::popcount64(word & ~((word << 1) | carry)); // Bits starting a run
+                carry = word >> 63;
+            }
+        }
+        return runs;
+    }
+
+    /** @brief Switches the container to its smallest kind, if that is smaller than now. */
+    static void optimize(Container& c) {
+        size_t runs = count_runs(c);
+        Kind best = c.kind;
+        for (Kind kind : {Kind::kArray, Kind::kBitmap, Kind::kRun}) {
+            if (bytes(c, kind, runs) < bytes(c, best, runs)) best = kind;
+        }
+        if (best == c.kind) return;
+
+        std::vector<uint16_t> values;
+        std::unique_ptr<uint64_t[]> bits;
+        if (best == Kind::kArray) {
+            values.reserve(c.cardinality);
+            for_each_low(c, [&](uint32_t low) { values.push_back(static_cast<uint16_t>(low)); });
+        } else if (best == Kind::kBitmap) {
+            bits.reset(new uint64_t[kBitmapWords]());
+            for_each_low(c, [&](uint32_t low) { bits[low >> 6] |= uint64_t{1} << (low & 63); });
+        } else {
+            values.reserve(2 * runs);
+            for_each_low(c, [&](uint32_t low) {
+                size_t n = values.size();
+                if (n != 0 && uint32_t{values[n - 2]} + values[n - 1] + 1 == low) {
+                    ++values[n - 1];
+                } else {
+                    values.push_back(static_cast<uint16_t>(low));
+                    values.push_back(0);
+                }
+            });
+        }
+        c.values = std::move(values);
+        c.bits = std::move(bits);
+        c.kind = best;
+    }
+};
+
+/**
+ * @brief A cache-line aligned bucket holding a lock and the actual data set.
+ *
+ * Aligning ensures that different buckets are less likely to cause
+ * false sharing cache contention when accessed by different threads/cores.
+ *
+ * Writers bracket every modification with `begin_write()`/`end_write()`
+ * while holding the lock, making `version` odd for the duration (a seqlock).
+ * Readers of storages that support it validate against `version` instead of
+ * taking the lock, so read-mostly buckets stay shared across cores.
+ *
+ * `generation` records the set's `Clear()` generation the contents belong
+ * to; contents of an older generation are logically empty and are discarded
+ * the next time a writer takes the lock.
+ *
+ * @tparam T The integer key type stored in the set.
+ * @tparam Storage The storage backend template (see "Storage backends").
+ * @tparam Lock The lock policy (see "Lock policies").
+ */
+template <typename T,
+          template <typename> class Storage = UnorderedSetStorage,
+          typename Lock = SpinLock>
+struct alignas(kCacheLineSize) Bucket {
+    mutable Lock lock; // Taken by const readers too; unused with lock striping
+    std::atomic<uint16_t> generation{0}; // Clear() generation of data_set; stale contents count as empty
+    std::atomic<uint32_t> version{0}; // Odd while a writer is inside
+    Storage<T> data_set;
+
+    // Default constructor needed for vector initialization
+    Bucket() = default;
+
+    // Explicitly define move constructor (rule of 5 if others are defined/deleted)
+    // Note: Moving buckets is generally not intended after construction
+    // due to the nature of the hash set, but required by vector sometimes.
+    Bucket(Bucket&& other) noexcept
+        : lock(), // Lock state is not transferred
+          generation(other.generation.load(std::memory_order_relaxed)),
+          version(0),
+          data_set(std::move(other.data_set))
+    {}
+
+    // Explicitly define move assignment operator
+    Bucket& operator=(Bucket&& other) noexcept {
+        if (this != &other) {
+            // Lock state is reset, not transferred
+            generation.store(other.generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            data_set = std::move(other.data_set);
+        }
+        return *this;
+    }
+
+    // Prevent copying
+    Bucket(const Bucket&) = delete;
+    Bucket& operator=(const Bucket&) = delete;
+
+    /** @brief Marks the start of a modification. Requires `lock` held. */
+    void begin_write() noexcept {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /** @brief Publishes a modification. Requires `lock` held. */
+    void end_write() noexcept {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Lock-free membership test validated by `version`.
+     * Only available for storages declaring `kOptimisticReads`.
+     * @param item The item to look up.
+     * @param current_generation The set's Clear() generation; contents of
+     *                           any other generation are treated as empty.
+     * @param exists Receives the result on success.
+     * @return true if no writer overlapped the read; false if the caller
+     *         must fall back to taking the lock.
+     */
+    bool try_contains_optimistic(const T& item, uint16_t current_generation, bool& exists) const noexcept {
+        for (int attempt = 0; attempt < kOptimisticReadAttempts; ++attempt) {
+            uint32_t before = version.load(std::memory_order_acquire);
+            if (before & 1) {
+                detail::cpu_relax(); // Writer inside
+                continue;
+            }
+            bool result = generation.load(std::memory_order_relaxed) == current_generation &&
+                          data_set.contains_optimistic(item);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version.load(std::memory_order_relaxed) == before) {
+                exists = result;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+/**
+ * @brief VelocitySet: An ultra-fast concurrent set for integer keys.
+ *
+ * Optimizes for high-throughput concurrent access using fine-grained locking,
+ * fast hashing, and cache-aware design.
+ *
+ * The bucket count follows the number of keys (linear hashing): when the
+ * average bucket load exceeds `max_bucket_load`, the next bucket in order is
+ * split in two; when it drops below a quarter of that, the last bucket is
+ * merged back into its partner. Each step moves the keys of one bucket only,
+ * so no operation ever pays for a full rehash, and lock granularity tracks
+ * the size of the data. Buckets live in segments that double in size and are
+ * never moved, so a bucket's address is stable for the life of the set.
+ *
+ * 8- and 16-bit key types (`uint8_t`, `int16_t`, ...) skip the buckets
+ * entirely: the set is one atomic bitmap over the whole key range (at most
+ * 8 KB), and every update is a single `fetch_or`/`fetch_and` with no lock.
+ * `Storage`, `Hash` and `Lock` are then unused.
+ *
+ * @tparam T Must be an integral type (int, uint32_t, size_t, etc.).
+ * @tparam Storage Per-bucket storage backend: `UnorderedSetStorage` (default)
+ *                 `FlatStorage` (open addressing, no per-key allocation),
+ *                 `SwissStorage` (SIMD fingerprint probing),
+ *                 `AdaptiveStorage` (inline array, table or bitmap by occupancy)
+ *                 or `RoaringStorage` (compressed 64K-key chunks; with `ChunkHash`).
+ * @tparam Hash Hash policy selecting the bucket: `IdentityHash` (default),
+ *              `FibonacciHash`, `Murmur3Hash`, `SeededHash` or `ChunkHash`.
+ * @tparam Lock Per-bucket lock policy: `SpinLock` (default), `BackoffSpinLock`
+ *              (test-and-test-and-set with exponential backoff), `RWSpinLock`
+ *              (concurrent readers on the same bucket), `FutexLock`
+ *              (spins briefly, then parks; for oversubscribed hosts), or the
+ *              fair FIFO `TicketLock` and `McsLock`.
+ */
+template <typename T,
+          template <typename> class Storage = UnorderedSetStorage,
+          typename Hash = IdentityHash,
+          typename Lock = SpinLock>
+class VelocitySet {
+    // Static assertion to ensure T is an integral type
+    static_assert(std::is_integral_v<T>, "VelocitySet requires an integral key type (e.g., int, size_t).");
+
+public:
+    static constexpr size_t kDefaultMaxBucketLoad = 64; // Average keys per bucket before splitting
+    static constexpr size_t kLockPerBucket = 0; // lock_stripes: each bucket has its own lock
+    static constexpr size_t kDefaultLockStripes = std::numeric_limits<size_t>::max(); // lock_stripes: size by hardware
+
+    /**
+     * @brief Constructs the concurrent set with a specified number of buckets.
+     *
+     * @param bucket_count The initial (and minimum) number of buckets. **Must be
+     *                     a power of two** for the fast bitwise hashing to work
+     *                     correctly. If 0 is passed, a default power-of-two size
+     *                     is calculated based on hardware concurrency.
+     * @param max_bucket_load Average number of keys per bucket above which the
+     *                        table grows by one bucket. If 0, the storage's
+     *                        `kDefaultMaxBucketLoad` if it declares one (e.g.
+     *                        `RoaringStorage`), else `kDefaultMaxBucketLoad`.
+     * @param hash The hash policy instance (e.g. a `SeededHash` with a fixed seed).
+     * @param lock_stripes Number of locks guarding the buckets, independent of
+     *                     the bucket count (bucket i uses lock i mod lock_stripes).
+     *                     `kLockPerBucket` (default) gives every bucket its own
+     *                     lock; `kDefaultLockStripes` sizes the stripes like the
+     *                     default bucket count. Otherwise **must be a power of two**.
+     * @throws std::invalid_argument if bucket_count or lock_stripes is not a
+     *         power of two (and not one of the special values above).
+     */
+    explicit VelocitySet(size_t bucket_count = 0, size_t max_bucket_load = 0, const Hash& hash = Hash(),
+                         size_t lock_stripes = kLockPerBucket)
+        : hash_(hash)
+    {
+        if (bucket_count == 0) {
+            initial_count_ = calculate_default_buckets();
+        } else {
+            if (!detail::is_power_of_two(bucket_count)) {
+                throw std::invalid_argument("VelocitySet: bucket_count must be a power of two.");
+            }
+            initial_count_ = bucket_count;
+        }
+        log2_initial_ = detail::floor_log2(initial_count_);
+        max_bucket_load_ = (max_bucket_load != 0) ? max_bucket_load
+                                                  : detail::storage_bucket_load<Storage<T>>::value(kDefaultMaxBucketLoad);
+        if (lock_stripes != kLockPerBucket) {
+            if (lock_stripes == kDefaultLockStripes) {
+                lock_stripes = calculate_default_buckets();
+            } else if (!detail::is_power_of_two(lock_stripes)) {
+                throw std::invalid_argument("VelocitySet: lock_stripes must be a power of two.");
+            }
+            stripes_.reset(new LockStripe[lock_stripes]);
+            stripe_mask_ = lock_stripes - 1;
+        }
+        for (auto& segment : segments_) segment.store(nullptr, std::memory_order_relaxed);
+        // Segment 0 holds the initial buckets; later segments appear as the table grows
+        segments_[0].store(new BucketType[initial_count_], std::memory_order_relaxed);
+    }
+
+    /** @brief A key range [base, base + size) kept as a bitmap; see the constructor below. */
+    struct DenseRange {
+        T base;
+        size_t size;
+    };
+
+    /**
+     * @brief Constructs a set whose keys mostly lie in a known range.
+     *
+     * Keys in [range.base, range.base + range.size) are kept in an atomic
+     * bitmap of one bit per possible key, and every operation on them is one
+     * atomic instruction on the key's word, plus counters on a per-thread
+     * cache line for updates, with no lock. Keys outside the range spill to
+     * the buckets as usual. For 8- and 16-bit keys, which always use a bitmap
+     * of the whole key range, the range is ignored.
+     *
+     * @param range The dense key range; allocates range.size / 8 bytes.
+     * @param bucket_count, max_bucket_load, hash, lock_stripes As in the
+     *        constructor above, for the keys outside the range.
+     * @throws std::invalid_argument if the range is empty, extends past the
+     *         largest T, or a bucket argument is invalid.
+     */
+    explicit VelocitySet(const DenseRange& range, size_t bucket_count = 0, size_t max_bucket_load = 0,
+                         const Hash& hash = Hash(), size_t lock_stripes = kLockPerBucket)
+        : VelocitySet(bucket_count, max_bucket_load, hash, lock_stripes)
+    {
+        uint64_t room = static_cast<uint64_t>(std::numeric_limits<T>::max()) - static_cast<uint64_t>(range.base);
+        if (range.size == 0 || range.size - 1 > room) {
+            throw std::invalid_argument("VelocitySet: dense range must be non-empty and within the key type.");
+        }
+        if constexpr (!kSmallKeys) {
+            dense_.reset(new detail::AtomicBitmap(range.size));
+            dense_base_ = static_cast<uint64_t>(range.base);
+            dense_size_ = range.size;
+        }
+    }
+
+    ~VelocitySet() {
+        for (auto& segment : segments_) delete[] segment.load(std::memory_order_relaxed);
+    }
+
+    // Non-copyable and non-movable
+    VelocitySet(const VelocitySet&) = delete;
+    VelocitySet& operator=(const VelocitySet&) = delete;
+
+    /**
+     * @brief Inserts an item into the set (thread-safe).
+     * @param item The integer item to insert.
+     */
+    void Insert(const T& item) noexcept {
+        if constexpr (kSmallKeys) {
+            small_keys_.insert(small_key_bit(item));
+            return;
+        }
+        uint64_t offset = dense_offset(item);
+        if (offset < dense_size_) {
+            dense_->insert(offset);
+            return;
+        }
+        if (insert_locked(item)) maybe_grow();
+    }
+
+    /**
+     * @brief Removes an item from the set (thread-safe).
+     * @param item The integer item to remove.
+     */
+    void Remove(const T& item) noexcept {
+        if constexpr (kSmallKeys) {
+            small_keys_.erase(small_key_bit(item));
+            return;
+        }
+        uint64_t offset = dense_offset(item);
+        if (offset < dense_size_) {
+            dense_->erase(offset);
+            return;
+        }
+        if (erase_locked(item)) maybe_shrink();
+    }
+
+    /**
+     * @brief Inserts an item and reports whether it was newly added (thread-safe).
+     * The check and the insert happen in one critical section, unlike
+     * `if (!Contains(k)) Insert(k)`.
+     * @param item The integer item to insert.
+     * @return true if the item was absent and has been added, false if it was present.
+     */
+    bool TryInsert(const T& item) noexcept {
+        if constexpr (kSmallKeys) return small_keys_.insert(small_key_bit(item));
+        uint64_t offset = dense_offset(item);
+        if (offset < dense_size_) return dense_->insert(offset);
+        bool inserted = insert_locked(item);
+        if (inserted) maybe_grow();
+        return inserted;
+    }
+
+    /**
+     * @brief Removes an item and reports whether it was present (thread-safe).
+     * @param item The integer item to remove.
+     * @return true if the item was present and has been removed, false otherwise.
+     */
+    bool TryRemove(const T& item) noexcept {
+        if constexpr (kSmallKeys) return small_keys_.erase(small_key_bit(item));
+        uint64_t offset = dense_offset(item);
+        if (offset < dense_size_) return dense_->erase(offset);
+        bool removed = erase_locked(item);
+        if (removed) maybe_shrink();
+        return removed;
+    }
+
+    /**
+     * @brief Atomically replaces old_item with new_item (thread-safe).
+     * Both buckets are locked together (in address order), so no thread can
+     * observe the set with both items missing or the old item still present
+     * after the new one appeared. For keys kept in a bitmap (8- and 16-bit
+     * keys, or a `DenseRange`) this holds when both keys fall in the same
+     * 64-key word; otherwise the old key is removed just before the new one
+     * is added.
+     * @param old_item The item to remove.
+     * @param new_item The item to insert in its place (may already be present).
+     * @return true if old_item was present and has been replaced; false if it
+     *         was absent, in which case the set is unchanged.
+     */
+    bool Replace(const T& old_item, const T& new_item) noexcept {
+        if (old_item == new_item) return Contains(old_item);
+        if constexpr (kSmallKeys) {
+            bool added;
+            return small_keys_.replace(small_key_bit(old_item), small_key_bit(new_item), added);
+        }
+        uint64_t old_offset = dense_offset(old_item);
+        uint64_t new_offset = dense_offset(new_item);
+        if (old_offset < dense_size_ && new_offset < dense_size_) {
+            bool added;
+            return dense_->replace(old_offset, new_offset, added);
+        }
+        if (old_offset < dense_size_ || new_offset < dense_size_) {
+            // One key in the bitmap and one in the buckets: no common lock
+            if (!TryRemove(old_item)) return false;
+            TryInsert(new_item);
+            return true;
+        }
+        size_t old_hash = hash_of(old_item);
+        size_t new_hash = hash_of(new_item);
+        for (;;) {
+            uint64_t state = state_.load(std::memory_order_acquire);
+            size_t old_index = hash_to_index(old_hash, state);
+            size_t new_index = hash_to_index(new_hash, state);
+            BucketType& old_bucket = bucket_at(old_index);
+            BucketType& new_bucket = bucket_at(new_index);
+            Lock& old_lock = lock_of(old_index, old_bucket);
+            Lock& new_lock = lock_of(new_index, new_bucket);
+            lock_pair(old_lock, new_lock);
+            uint64_t current = state_.load(std::memory_order_acquire);
+            if (hash_to_index(old_hash, current) != old_index || hash_to_index(new_hash, current) != new_index) {
+                unlock_pair(old_lock, new_lock); // Split or merged meanwhile; retry
+                continue;
+            }
+
+            uint16_t generation = current_generation();
+            bool replaced = false;
+            bool added = false;
+            if (is_current(old_bucket, generation) && old_bucket.data_set.contains(old_item)) {
+                preserve_pair(old_bucket, old_index, new_bucket, new_index);
+                refresh(new_bucket, generation);
+                old_bucket.begin_write();
+                if (&new_bucket != &old_bucket) new_bucket.begin_write();
+                old_bucket.data_set.erase(old_item);
+                added = new_bucket.data_set.insert(new_item);
+                if (&new_bucket != &old_bucket) new_bucket.end_write();
+                old_bucket.end_write();
+                replaced = true;
+            }
+            unlock_pair(old_lock, new_lock);
+            if (replaced && !added) {
+                // new_item was already present
+                adjust_size(1, kSizeSubtract, generation);
+                maybe_shrink();
+            }
+            return replaced;
+        }
+    }
+
+    /**
+     * @brief Inserts many items, locking each touched bucket once (thread-safe).
+     * Keys are partitioned by bucket with a radix pass, then every bucket's
+     * keys are applied in a single critical section. Much faster than calling
+     * `Insert` in a loop for bulk ingestion. Not atomic as a whole: concurrent
+     * readers may observe a prefix of the batch per bucket.
+     * @param items The items to insert.
+     * @param count Number of items.
+     * @param inserted Optional; if non-null, inserted[i] is set to 1 if items[i]
+     *                 was newly added and 0 if it was already present (or is a
+     *                 repeat of an earlier key in the same batch).
+     * @return The number of items newly added.
+     * @throws std::bad_alloc if the partition buffers cannot be allocated.
+     */
+    size_t InsertBatch(const T* items, size_t count, uint8_t* inserted = nullptr) {
+        if constexpr (kSmallKeys) return apply_small_batch<kBatchInsert>(items, count, inserted);
+        size_t added = 0;
+        while (count != 0) {
+            // Chunk by the current capacity so the table grows along with the batch
+            // instead of overfilling buckets and splitting them afterwards
+            size_t capacity = bucket_count(state_.load(std::memory_order_relaxed)) * max_bucket_load_;
+            size_t chunk = std::min(count, std::max(kMinBatchChunk, capacity / 2));
+            size_t chunk_added = apply_batch<kBatchInsert>(items, chunk, inserted);
+            if (chunk_added != 0) maybe_grow(chunk_added);
+            added += chunk_added;
+            items += chunk;
+            if (inserted != nullptr) inserted += chunk;
+            count -= chunk;
+        }
+        return added;
+    }
+
+    /**
+     * @brief Removes many items, locking each touched bucket once (thread-safe).
+     * @param items The items to remove.
+     * @param count Number of items.
+     * @param removed Optional; if non-null, removed[i] is set to 1 if items[i]
+     *                was present and removed by this call, 0 otherwise.
+     * @return The number of items removed.
+     * @throws std::bad_alloc if the partition buffers cannot be allocated.
+     */
+    size_t RemoveBatch(const T* items, size_t count, uint8_t* removed = nullptr) {
+        if constexpr (kSmallKeys) return apply_small_batch<kBatchErase>(items, count, removed);
+        size_t erased = apply_batch<kBatchErase>(items, count, removed);
+        if (erased != 0) maybe_shrink(erased);
+        return erased;
+    }
+
+    /**
+     * @brief Checks if an item exists in the set (thread-safe).
+     * With a storage backend supporting optimistic reads (e.g. `FlatStorage`)
+     * this does not take the bucket lock unless a writer races the lookup.
+     * @param item The integer item to check for.
+     * @return true if the item is present, false otherwise.
+     */
+    bool Contains(const T& item) const noexcept {
+        if constexpr (kSmallKeys) return small_keys_.contains(small_key_bit(item));
+        uint64_t offset = dense_offset(item);
+        if (offset < dense_size_) return dense_->contains(offset);
+        return contains_hashed(item, hash_of(item));
+    }
+
+    /**
+     * @brief Looks up many items at once, overlapping their cache misses (thread-safe).
+     * Keys are resolved in groups: the buckets of a whole group are prefetched,
+     * then (for storages with a `prefetch` hint, e.g. `FlatStorage`) their
+     * storage slots, and only then is each key looked up. Each result is the
+     * same as a `Contains` call; the batch is not a consistent snapshot.
+     * @param items The items to look up.
+     * @param count Number of items.
+     * @param out out[i] is set to 1 if items[i] is present, 0 otherwise.
+     * @return The number of items found.
+     */
+    size_t ContainsBatch(const T* items, size_t count, uint8_t* out) const noexcept {
+        if constexpr (kSmallKeys) {
+            size_t found = 0;
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = small_keys_.contains(small_key_bit(items[i]));
+                found += out[i];
+            }
+            return found;
+        }
+        size_t hashes[kLookupGroupSize];
+        BucketType* buckets[kLookupGroupSize];
+        size_t found = 0;
+        for (size_t begin = 0; begin < count; begin += kLookupGroupSize) {
+            size_t group = std::min(kLookupGroupSize, count - begin);
+            uint64_t state = state_.load(std::memory_order_acquire);
+            for (size_t g = 0; g < group; ++g) {
+                uint64_t offset = dense_offset(items[begin + g]);
+                if (offset < dense_size_) {
+                    buckets[g] = nullptr; // Kept in the range bitmap
+                    dense_->prefetch(offset);
+                    continue;
+                }
+                hashes[g] = hash_of(items[begin + g]);
+                buckets[g] = &bucket_at(hash_to_index(hashes[g], state));
+                detail::prefetch(buckets[g]);
+            }
+            if constexpr (kStoragePrefetch) {
+                for (size_t g = 0; g < group; ++g) {
+                    if (buckets[g] != nullptr) buckets[g]->data_set.prefetch(items[begin + g]);
+                }
+            }
+            for (size_t g = 0; g < group; ++g) {
+                bool exists = buckets[g] != nullptr ? contains_hashed(items[begin + g], hashes[g])
+                                                    : dense_->contains(dense_offset(items[begin + g]));
+                out[begin + g] = exists;
+                found += exists;
+            }
+        }
+        return found;
+    }
+
+    /**
+     * @brief Returns the number of buckets being used.
+     * Changes as the set grows and shrinks; it is a power of two only between
+     * rounds of splitting.
+     * @return The current number of buckets.
+     */
+    size_t GetBucketCount() const noexcept {
+        return bucket_count(state_.load(std::memory_order_acquire));
+    }
+
+    /**
+     * @brief Returns the number of locks guarding the buckets.
+     * @return The lock stripe count, or the bucket count with one lock per bucket.
+     */
+    size_t GetLockCount() const noexcept {
+        return stripes_ ? stripe_mask_ + 1 : GetBucketCount();
+    }
+
+    /**
+     * @brief Clears all elements from the set in constant time (thread-safe).
+     * Only bumps the set's generation number: every bucket still holding
+     * contents of an older generation reads as empty, and is reset the next
+     * time a writer touches it (or by `ReclaimCleared()`). Operations racing
+     * with `Clear()` take effect either before or after it.
+     * Once every 65536 calls the 16-bit generation wraps around and this call
+     * resets all stale buckets eagerly instead. Waits for a running
+     * `Snapshot()` to finish.
+     * The bucket count shrinks back gradually as the set is used again.
+     * For 8- and 16-bit keys, zeroes the key bitmap word by word instead.
+     * A `DenseRange` bitmap is zeroed word by word too, in O(range / 64);
+     * updates to a bitmap wait while it is zeroed.
+     */
+    void Clear() noexcept {
+        if constexpr (kSmallKeys) {
+            small_keys_.clear();
+            return;
+        }
+        std::lock_guard<std::mutex> guard(snapshot_mutex_); // A snapshot sees a single generation
+        if (dense_size_ != 0) dense_->clear();
+        uint16_t generation = generation_.load(std::memory_order_relaxed);
+        uint16_t next = static_cast<uint16_t>(generation + 1);
+        if (next == 0) {
+            // The next tag was last used 65536 clears ago: no bucket may still carry it
+            size_t count = pin_layout();
+            for (size_t i = 0; i < count; ++i) {
+                BucketType& bucket = bucket_at(i);
+                Lock& lock = lock_of(i, bucket);
+                lock.lock();
+                refresh(bucket, generation);
+                lock.unlock();
+            }
+            unpin_layout();
+        }
+        // Reset the count before publishing the generation: a writer that sees
+        // the new generation must also see the count it belongs to
+        for (SizeShard& shard : size_shards_) {
+            shard.word.store(static_cast<uint64_t>(next) << kSizeGenerationShift, std::memory_order_relaxed);
+        }
+        generation_.store(next, std::memory_order_release);
+    }
+
+    /**
+     * @brief Frees memory still held by buckets emptied by `Clear()` (thread-safe).
+     * Stale buckets are otherwise reset lazily when next written to; run this
+     * from a background thread to return their memory sooner.
+     * Storages declaring `kOptimisticReads` (`FlatStorage`) are only emptied:
+     * a lock-free `Contains` may still be probing their tables, so they keep
+     * their memory until the set is destroyed.
+     * @return The number of buckets reset.
+     */
+    size_t ReclaimCleared() noexcept {
+        if constexpr (kSmallKeys) return 0;
+        size_t count = pin_layout();
+        size_t reclaimed = 0;
+        for (size_t i = 0; i < count; ++i) {
+            BucketType& bucket = bucket_at(i);
+            Lock& lock = lock_of(i, bucket);
+            lock.lock();
+            uint16_t generation = current_generation();
+            if (!is_current(bucket, generation)) {
+                preserve(bucket, i);
+                refresh(bucket, generation);
+                ++reclaimed;
+            }
+            lock.unlock();
+        }
+        unpin_layout();
+        return reclaimed;
+    }
+
+    /**
+     * @brief Returns the number of elements without locking anything (thread-safe).
+     * Sums a fixed array of per-thread-sharded counters, which Insert/Remove
+     * update only when they change the set. Exact when no modification is in
+     * flight; otherwise off by at most the modifications in flight.
+     * Key bitmaps (8- and 16-bit keys, or a `DenseRange`) count the bits
+     * their updates set and clear in sharded counters of their own, summed
+     * the same way.
+     * @return Number of elements.
+     */
+    size_t Size() const noexcept {
+        if constexpr (kSmallKeys) return small_keys_.size();
+        return bucket_size() + (dense_size_ != 0 ? dense_->size() : 0);
+    }
+
+    /**
+     * @brief Returns the approximate total number of elements in the set.
+     * Same as `Size()`: no bucket is locked.
+     * @return Approximate number of elements.
+     */
+    size_t GetApproximateSize() const noexcept {
+        return Size();
+    }
+
+    /**
+     * @brief Returns the exact number of elements at a single instant (thread-safe).
+     * Counts every bucket under its lock while noting its version, then
+     * re-reads all versions without locking: if none changed (and no
+     * `Clear()` ran), every bucket held the counted contents at the moment
+     * the first pass ended. After `kExactSizeAttempts` failed attempts under
+     * heavy writes, falls back to counting a `Snapshot()`. Key bitmaps (8-
+     * and 16-bit keys, or a `DenseRange`) are counted between the passes and
+     * validated against the bitmap's writer count in the same way.
+     * @return Number of elements at one linearization point.
+     * @throws std::bad_alloc if the version buffer cannot be allocated.
+     */
+    size_t SizeExact() const {
+        if constexpr (kSmallKeys) {
+            for (int attempt = 0; attempt < kExactSizeAttempts; ++attempt) {
+                uint64_t stamp;
+                if (!small_keys_.read_begin(stamp)) continue;
+                size_t total = small_keys_.size();
+                if (small_keys_.read_validate(stamp)) return total;
+            }
+            return Snapshot().Size();
+        }
+        for (int attempt = 0; attempt < kExactSizeAttempts; ++attempt) {
+            size_t count = pin_layout();
+            std::vector<uint32_t> versions;
+            try {
+                versions.resize(count);
+            } catch (...) {
+                unpin_layout();
+                throw;
+            }
+            uint16_t generation = current_generation();
+            size_t total = 0;
+            for (size_t i = 0; i < count; ++i) {
+                BucketType& bucket = bucket_at(i);
+                Lock& lock = lock_of(i, bucket);
+                detail::lock_for_read(lock);
+                versions[i] = bucket.version.load(std::memory_order_relaxed);
+                if (is_current(bucket, generation)) total += bucket.data_set.size();
+                detail::unlock_for_read(lock);
+            }
+            // The bitmap must hold still from here to the end of the second pass
+            uint64_t stamp = 0;
+            bool stable = dense_size_ == 0 || dense_->read_begin(stamp);
+            if (stable && dense_size_ != 0) total += dense_->size();
+            std::atomic_thread_fence(std::memory_order_seq_cst); // Second pass strictly after the first
+            stable = stable && current_generation() == generation;
+            for (size_t i = 0; i < count && stable; ++i) {
+                stable = bucket_at(i).version.load(std::memory_order_acquire) == versions[i];
+            }
+            if (stable && dense_size_ != 0) stable = dense_->read_validate(stamp);
+            unpin_layout();
+            if (stable) return total;
+        }
+        return Snapshot().Size();
+    }
+
+    /**
+     * @brief An immutable point-in-time copy of a VelocitySet, from `Snapshot()`.
+     * Keys are stored grouped by the bucket they occupied and sorted within
+     * each bucket, so `Contains` is one hash plus a short binary search.
+     */
+    class SnapshotView {
+    public:
+        /** @brief Returns the exact number of items at the snapshot point. */
+        size_t Size() const noexcept { return keys_.size(); }
+
+        /** @brief Checks whether item was in the set at the snapshot point. */
+        bool Contains(const T& item) const noexcept {
+            if (static_cast<uint64_t>(item) - dense_base_ < dense_size_) {
+                auto by_offset = [this](const T& a, const T& b) {
+                    return static_cast<uint64_t>(a) - dense_base_ < static_cast<uint64_t>(b) - dense_base_;
+                };
+                return std::binary_search(keys_.begin() + offsets_.back(), keys_.end(), item, by_offset);
+            }
+            size_t round = initial_count_ << level_of(state_);
+            size_t hash = hash_(item);
+            size_t index = hash & (round - 1);
+            if (index < split_of(state_)) index = hash & (round * 2 - 1);
+            return std::binary_search(keys_.begin() + offsets_[index], keys_.begin() + offsets_[index + 1], item);
+        }
+
+        /** @brief Calls fn(item) for every item, in no particular order. */
+        template <typename Fn>
+        void ForEach(Fn&& fn) const {
+            for (const T& item : keys_) fn(item);
+        }
+
+        /** @brief All items, grouped by bucket and then the dense range (for bulk serialization). */
+        const std::vector<T>& Keys() const noexcept { return keys_; }
+
+    private:
+        friend class VelocitySet;
+
+        SnapshotView(const Hash& hash, size_t initial_count, uint64_t state)
+            : hash_(hash), initial_count_(initial_count), state_(state) {}
+
+        Hash hash_;
+        size_t initial_count_;
+        uint64_t state_;             // Bucket layout at the snapshot point
+        std::vector<T> keys_;
+        std::vector<size_t> offsets_; // Bucket i holds keys_[offsets_[i], offsets_[i + 1])
+        uint64_t dense_base_ = 0;     // DenseRange keys follow the buckets, ordered by offset
+        uint64_t dense_size_ = 0;
+    };
+
+    /**
+     * @brief Captures the exact contents of the set at a single point in time.
+     * Writers keep running during the capture: the first write to each bucket
+     * after the snapshot point saves the bucket's old contents before
+     * modifying it (copy-on-write), and the snapshot copies every bucket
+     * nobody saved. Each bucket is copied once. Resizing pauses until the
+     * capture completes; concurrent `Snapshot()` calls are serialized.
+     * Key bitmaps (8- and 16-bit keys, or a `DenseRange`) have no buckets to
+     * save: their writers wait at the snapshot point while the bitmap is
+     * copied, which takes O(range / 64).
+     * @return An immutable view, independent of later changes to the set.
+     * @throws std::bad_alloc if the copy cannot be allocated.
+     */
+    SnapshotView Snapshot() const {
+        if constexpr (kSmallKeys) {
+            // One "bucket" holding every key: Contains is a single binary search
+            SnapshotView view(hash_, 1, make_state(0, 0));
+            view.keys_.reserve(kSmallKeyRange); // Before pausing the writers: cannot throw below
+            small_keys_.pause_writers();
+            small_keys_.for_each(0, small_keys_.word_count(),
+                                 [&](size_t bit) { view.keys_.push_back(small_key_of(bit)); });
+            small_keys_.resume_writers();
+            std::sort(view.keys_.begin(), view.keys_.end()); // Signed keys wrap around
+            view.offsets_ = {0, view.keys_.size()};
+            return view;
+        }
+        std::lock_guard<std::mutex> guard(snapshot_mutex_);
+        size_t count = pin_layout();
+        SnapshotView view(hash_, initial_count_, state_.load(std::memory_order_relaxed));
+        Capture capture;
+        capture.generation = current_generation(); // Stable: Clear() needs snapshot_mutex_
+        try {
+            capture.parts.resize(count);
+            capture.taken.assign(count, 0);
+        } catch (...) {
+            unpin_layout();
+            throw;
+        }
+
+        std::vector<T> dense_keys;
+        if (dense_size_ != 0) {
+            // Frozen across the snapshot point, so it matches the buckets there
+            dense_->pause_writers();
+            capture_.store(&capture, std::memory_order_seq_cst); // The snapshot point
+            try {
+                dense_keys.reserve(dense_->size());
+                dense_->for_each(0, dense_->word_count(),
+                                 [&](size_t offset) { dense_keys.push_back(dense_key_of(offset)); });
+            } catch (...) {
+                dense_->resume_writers();
+                retire_capture();
+                unpin_layout();
+                throw;
+            }
+            dense_->resume_writers();
+        } else {
+            capture_.store(&capture, std::memory_order_seq_cst); // The snapshot point
+        }
+        try {
+            for (size_t i = 0; i < count; ++i) {
+                BucketType& bucket = bucket_at(i);
+                Lock& lock = lock_of(i, bucket);
+                detail::lock_for_read(lock); // Writers hold the lock exclusively
+                try {
+                    if (!capture.taken[i]) capture.take(i, bucket);
+                } catch (...) {
+                    detail::unlock_for_read(lock);
+                    throw;
+                }
+                detail::unlock_for_read(lock);
+            }
+        } catch (...) {
+            retire_capture();
+            unpin_layout();
+            throw;
+        }
+        retire_capture();
+        unpin_layout();
+
+        size_t total = 0;
+        for (const std::vector<T>& part : capture.parts) total += part.size();
+        view.keys_.reserve(total + dense_keys.size());
+        view.offsets_.reserve(count + 1);
+        for (std::vector<T>& part : capture.parts) {
+            view.offsets_.push_back(view.keys_.size());
+            std::sort(part.begin(), part.end());
+            view.keys_.insert(view.keys_.end(), part.begin(), part.end());
+        }
+        view.offsets_.push_back(view.keys_.size());
+        if (dense_size_ != 0) {
+            view.dense_base_ = dense_base_;
+            view.dense_size_ = dense_size_;
+            view.keys_.insert(view.keys_.end(), dense_keys.begin(), dense_keys.end());
+        }
+        return view;
+    }
+
+    /**
+     * @brief Writes the set to a binary file, for a fast restart with `LoadFrom`.
+     * The contents are taken with `Snapshot()`, so writers keep running and
+     * the file holds the set at a single point in time. Keys are laid out by
+     * bucket index behind a small header (see `detail::SetFileHeader`). The
+     * file is written beside path under a unique temporary name, synced, and
+     * renamed over path; the directory is then synced too, so a crash never
+     * leaves a truncated file at path and concurrent saves to one path do
+     * not interfere (the last rename wins).
+     * @param path The file to create or replace.
+     * @throws std::system_error if the file cannot be written.
+     * @throws std::bad_alloc if the snapshot cannot be allocated.
+     */
+    void SaveTo(const std::string& path) const {
+        SnapshotView view = Snapshot();
+        detail::SetFileHeader header{};
+        header.magic = detail::SetFileHeader::kMagic;
+        header.version = detail::SetFileHeader::kVersion;
+        header.byte_order = detail::SetFileHeader::kByteOrder;
+        header.key_bytes = sizeof(T);
+        header.key_signed = std::is_signed_v<T>;
+        header.hash_fingerprint = hash_fingerprint();
+        header.bucket_count = view.offsets_.size() - 1;
+        header.key_count = view.keys_.size();
+        header.dense_base = view.dense_base_;
+        header.dense_size = view.dense_size_;
+        std::vector<uint64_t> offsets(view.offsets_.begin(), view.offsets_.end());
+
+        std::string temp;
+        std::FILE* file = detail::create_temp_file(path, temp);
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size() &&
+                       write_keys(file, view.keys_) && std::fflush(file) == 0;
+#if defined(VELOCITY_POSIX_FILES)
+        written = written && ::fsync(::fileno(file)) == 0;
+#endif
+        int error = errno;
+        if (std::fclose(file) != 0 && written) {
+            written = false;
+            error = errno;
+        }
+        if (written && std::rename(temp.c_str(), path.c_str()) != 0) {
+            written = false;
+            error = errno;
+        }
+        if (!written) {
+            std::remove(temp.c_str());
+            throw std::system_error(error, std::generic_category(), "VelocitySet: cannot write " + path);
+        }
+        detail::sync_parent_directory(path);
+    }
+
+    /**
+     * @brief Adds the keys of a file written by `SaveTo` (thread-safe).
+     * The file is memory-mapped and keys are inserted straight from the
+     * mapping. If this set holds no keys yet and its hash policy places keys
+     * like the one that wrote the file, the table is first split to the
+     * file's bucket count; each bucket of the file is then built into the
+     * same bucket of this set under a single lock acquisition, across
+     * num_threads workers. Otherwise the keys are added by parallel
+     * `InsertBatch` slices.
+     * @param path A file written by `SaveTo` for the same key type.
+     * @param num_threads Number of workers, including the calling thread; 0
+     *                    uses hardware concurrency.
+     * @return The number of keys added.
+     * @throws std::system_error if the file cannot be read.
+     * @throws std::runtime_error if the file is not a valid set file for T.
+     * @throws std::bad_alloc if buffers for the keys cannot be allocated.
+     */
+    size_t LoadFrom(const std::string& path, size_t num_threads = 0) {
+        detail::MappedFile file(path);
+        const detail::SetFileHeader& header = check_file(file, path);
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(file.data() + sizeof(header));
+        const T* keys = reinterpret_cast<const T*>(offsets + header.bucket_count + 1);
+        size_t bucket_keys = offsets[header.bucket_count];
+        size_t added;
+        if (kSmallKeys || bucket_size() != 0 || header.hash_fingerprint != hash_fingerprint() ||
+            header.bucket_count < initial_count_ || !presize(header.bucket_count)) {
+            added = load_keys(keys, header.key_count, num_threads);
+        } else {
+            added = load_buckets(offsets, keys, header.bucket_count, num_threads);
+            added += load_keys(keys + bucket_keys, header.key_count - bucket_keys, num_threads);
+        }
+        if (added != 0) maybe_grow(added);
+        return added;
+    }
+
+    /**
+     * @brief Calls fn(item) for every item in the set (thread-safe).
+     * Buckets are visited one at a time under their own (shared, if
+     * supported) lock, so writers to other buckets keep running. Splits and
+     * merges are held off for the duration so no bucket is seen twice; an
+     * item inserted or removed concurrently may or may not be visited.
+     * fn must not call back into this set.
+     * @param fn Callable as fn(const T&). If it throws, the walk stops and the
+     *           exception propagates.
+     */
+    template <typename Fn>
+    void ForEach(Fn&& fn) const {
+        if constexpr (kSmallKeys) {
+            visit_small_keys(0, small_keys_.word_count(), fn);
+            return;
+        }
+        size_t count = pin_layout();
+        try {
+            visit_buckets(0, count, fn);
+        } catch (...) {
+            unpin_layout();
+            throw;
+        }
+        unpin_layout();
+        if (dense_size_ != 0) visit_dense(0, dense_->word_count(), fn);
+    }
+
+    /**
+     * @brief Like `ForEach`, but splits the buckets across worker threads.
+     * Workers claim chunks of consecutive buckets (then of `DenseRange`
+     * bitmap words) from a shared counter, so uneven buckets still balance.
+     * The calling thread is one of the workers.
+     * @param fn Callable as fn(const T&); called concurrently from several
+     *           threads. If it throws, the remaining chunks are skipped and the
+     *           first exception is rethrown once all workers have stopped.
+     * @param num_threads Number of workers; 0 uses hardware concurrency.
+     *                    Ignored for 8- and 16-bit keys, whose bitmap is
+     *                    walked on the calling thread.
+     */
+    template <typename Fn>
+    void ParallelForEach(Fn&& fn, size_t num_threads = 0) const {
+        if constexpr (kSmallKeys) {
+            visit_small_keys(0, small_keys_.word_count(), fn); // An 8 KB scan: not worth a thread
+            return;
+        }
+        size_t count = pin_layout();
+        // Work units past the buckets are the words of the DenseRange bitmap
+        size_t units = count + (dense_size_ != 0 ? dense_->word_count() : 0);
+        try {
+            run_chunked(units, num_threads, [&](size_t begin, size_t end) {
+                if (begin < count) visit_buckets(begin, std::min(end, count), fn);
+                if (end > count) visit_dense(std::max(begin, count) - count, end - count, fn);
+            });
+        } catch (...) {
+            unpin_layout();
+            throw;
+        }
+        unpin_layout();
+    }
+
+    /**
+     * @brief Adds every key of other to this set (thread-safe).
+     * If both sets share a layout (the same bucket count, equal hash policies
+     * and the same `DenseRange`), a key can only be in bucket i of one set if
+     * it belongs in bucket i of the other: the bucket pairs are then merged
+     * independently across worker threads, each pair under its two bucket
+     * locks, and range bitmaps word by word. Otherwise other's keys are
+     * collected and added with `InsertBatch`. Each bucket pair is combined
+     * atomically; the operation as a whole is not. Splits are held off while
+     * the buckets are merged and catch up afterwards.
+     * @param other The set whose keys to add.
+     * @param num_threads Number of workers, including the calling thread; 0
+     *                    uses hardware concurrency. Small sets use fewer.
+     * @return The number of keys added.
+     * @throws std::bad_alloc if buffers for the keys cannot be allocated.
+     */
+    size_t UnionWith(const VelocitySet& other, size_t num_threads = 0) {
+        size_t added = combine<SetOperation::kUnion>(other, num_threads);
+        if (added != 0) maybe_grow(added);
+        return added;
+    }
+
+    /**
+     * @brief Removes every key that other does not contain (thread-safe).
+     * Runs bucket pair by bucket pair when both sets share a layout, as
+     * `UnionWith` does; otherwise this set's keys are looked up in other with
+     * `ContainsBatch` and the missing ones removed with `RemoveBatch`.
+     * @return The number of keys removed.
+     * @throws std::bad_alloc if buffers for the keys cannot be allocated.
+     */
+    size_t IntersectWith(const VelocitySet& other, size_t num_threads = 0) {
+        size_t removed = combine<SetOperation::kIntersect>(other, num_threads);
+        if (removed != 0) maybe_shrink(removed);
+        return removed;
+    }
+
+    /**
+     * @brief Removes every key that other contains (thread-safe).
+     * Runs bucket pair by bucket pair when both sets share a layout, as
+     * `UnionWith` does; otherwise the keys of the smaller set are looked up
+     * and removed in batches.
+     * @return The number of keys removed.
+     * @throws std::bad_alloc if buffers for the keys cannot be allocated.
+     */
+    size_t Subtract(const VelocitySet& other, size_t num_threads = 0) {
+        size_t removed = combine<SetOperation::kSubtract>(other, num_threads);
+        if (removed != 0) maybe_shrink(removed);
+        return removed;
+    }
+
+    /**
+     * @brief Builds the intersection of two sets, leaving both unchanged (thread-safe).
+     * The result is configured like a (bucket count, bucket load, hash, lock
+     * stripes and `DenseRange`). With a shared layout, bucket pairs are
+     * intersected in parallel and each worker adds its matches to the result
+     * with `InsertBatch`; otherwise the smaller set's keys are looked up in
+     * the larger one.
+     * @return The new set, on the heap since sets are not movable.
+     * @throws std::bad_alloc if the set or buffers cannot be allocated.
+     */
+    static std::unique_ptr<VelocitySet> Intersect(const VelocitySet& a, const VelocitySet& b,
+                                                  size_t num_threads = 0) {
+        std::unique_ptr<VelocitySet> result = a.empty_like();
+        if constexpr (kSmallKeys) {
+            size_t words = result->small_keys_.word_count();
+            result->small_keys_.unite(a.small_keys_, 0, words);
+            result->small_keys_.intersect(b.small_keys_, 0, words);
+            return result;
+        }
+        if (&a == &b) {
+            detail::KeyBuffer<T> keys = a.collect_keys();
+            result->InsertBatch(keys.data(), keys.size());
+            return result;
+        }
+        size_t count = a.pin_layout();
+        b.pin_layout();
+        if (!a.shares_layout(b, count)) {
+            a.unpin_layout();
+            b.unpin_layout();
+            const VelocitySet& smaller = a.Size() <= b.Size() ? a : b;
+            const VelocitySet& larger = &smaller == &a ? b : a;
+            detail::KeyBuffer<T> hits = larger.find_keys(smaller.collect_keys(), true);
+            result->InsertBatch(hits.data(), hits.size());
+            return result;
+        }
+        size_t units = count + (a.dense_size_ != 0 ? a.dense_->word_count() : 0);
+        try {
+            run_chunked(units, set_workers(units, num_threads), [&](size_t begin, size_t end) {
+                detail::KeyBuffer<T> hits;
+                for (size_t i = begin; i < std::min(end, count); ++i) intersect_bucket(a, b, i, hits);
+                if (!hits.empty()) result->InsertBatch(hits.data(), hits.size());
+                if (end > count) {
+                    size_t first = std::max(begin, count) - count;
+                    result->dense_->unite(*a.dense_, first, end - count);
+                    result->dense_->intersect(*b.dense_, first, end - count);
+                }
+            });
+        } catch (...) {
+            a.unpin_layout();
+            b.unpin_layout();
+            throw;
+        }
+        a.unpin_layout();
+        b.unpin_layout();
+        return result;
+    }
+
+private:
+    using BucketType = Bucket<T, Storage, Lock>;
+    static constexpr bool kOptimisticReads = detail::has_optimistic_reads<Storage<T>>::value;
+    static constexpr bool kStoragePrefetch = detail::has_prefetch<Storage<T>, T>::value;
+    static constexpr bool kRead = true; // lock_bucket<kRead>: shared where supported
+    static constexpr size_t kLookupGroupSize = 16; // ContainsBatch keys in flight at once
+    static constexpr size_t kChunksPerWorker = 8;  // ParallelForEach load-balancing granularity
+    static constexpr size_t kMinUnitsPerWorker = 256; // Set algebra: buckets or words worth a thread
+    static constexpr size_t kLoadSlice = size_t{1} << 16; // LoadFrom keys per InsertBatch call
+    // Keys of at most 16 bits live in a lock-free bitmap of the whole key range (8 KB at most)
+    static constexpr bool kSmallKeys = sizeof(T) <= 2 && !std::is_same_v<T, bool>;
+    static constexpr size_t kSmallKeyRange = size_t{1} << (kSmallKeys ? 8 * sizeof(T) : 0);
+
+    /** @brief One lock of the striped lock array, alone on its cache line. */
+    struct alignas(kCacheLineSize) LockStripe {
+        mutable Lock lock;
+    };
+
+    static constexpr bool kBatchInsert = true; // apply_batch<kBatchInsert> / apply_batch<kBatchErase>
+    static constexpr bool kBatchErase = false;
+    static constexpr unsigned kRadixBits = 8;  // Digit width of the batch partition pass
+    static constexpr size_t kMinBatchChunk = 4096; // Smallest InsertBatch slice applied between growth steps
+
+    enum class SetOperation { kUnion, kIntersect, kSubtract };
+
+    /** @brief A batch key tagged with its bucket; position indexes the caller's array. */
+    struct BatchEntry {
+        size_t index;
+        size_t position;
+    };
+
+    /** @brief Bucket copies of a running `Snapshot()`, indexed by bucket. */
+    struct Capture {
+        std::vector<std::vector<T>> parts;
+        std::vector<uint8_t> taken; // Guarded by the lock of the bucket
+        uint16_t generation = 0;    // Clear() generation at the snapshot point
+
+        void take(size_t index, const BucketType& bucket) {
+            if (bucket.generation.load(std::memory_order_relaxed) == generation) {
+                std::vector<T>& part = parts[index];
+                part.reserve(bucket.data_set.size());
+                bucket.data_set.for_each([&](const T& item) { part.push_back(item); });
+            }
+            taken[index] = 1;
+        }
+    };
+
+    /** @brief A bucket together with the lock that is held on it. */
+    struct LockedBucket {
+        BucketType& bucket;
+        Lock& lock;
+        size_t index;
+    };
+
+    // Layout state packs the linear hashing level and split pointer in one word:
+    // the table has (initial_count_ << level) + split buckets, and buckets below
+    // `split` have already been split for the current level.
+    static constexpr unsigned kLevelShift = 58;
+    static constexpr uint64_t kSplitMask = (uint64_t{1} << kLevelShift) - 1;
+    static constexpr size_t kMaxSegments = 64;
+    static constexpr unsigned kSizeGenerationShift = 48;
+    static constexpr uint64_t kSizeCountMask = (uint64_t{1} << kSizeGenerationShift) - 1;
+    static constexpr bool kSizeAdd = true; // adjust_size(count, kSizeAdd / kSizeSubtract, ...)
+    static constexpr bool kSizeSubtract = false;
+    static constexpr size_t kSizeShards = 64;          // Power of two
+    static constexpr uint32_t kResizeCheckInterval = 16; // Single-key updates per thread between resize checks
+    static constexpr int kExactSizeAttempts = 4;
+
+    /** @brief One counter of the sharded element count, alone on its cache line. */
+    struct alignas(kCacheLineSize) SizeShard {
+        std::atomic<uint64_t> word{0};
+    };
+
+    Hash hash_;
+    std::atomic<BucketType*> segments_[kMaxSegments]; // Segment s > 0 holds initial_count_ << (s - 1) buckets
+    std::atomic<uint64_t> state_{0};
+    std::atomic<uint16_t> generation_{0}; // Bumped by Clear(); see Bucket::generation
+    size_t initial_count_;   // Minimum bucket count (power of two)
+    unsigned log2_initial_;  // log2(initial_count_)
+    size_t max_bucket_load_; // Average keys per bucket that triggers a split
+    std::unique_ptr<LockStripe[]> stripes_; // Null with one lock per bucket
+    size_t stripe_mask_ = 0;                // Stripe count - 1
+
+    mutable SpinLock resize_lock_;   // Serializes split/merge steps
+    mutable std::atomic<size_t> layout_pins_{0}; // Running ForEach walks; no resizing while non-zero
+    mutable std::atomic<Capture*> capture_{nullptr}; // Running Snapshot(), if any
+    mutable std::mutex snapshot_mutex_;              // Serializes Snapshot() calls
+    std::vector<T> resize_scratch_;  // Keys being moved; guarded by resize_lock_
+    // Number of keys, drives resizing; see Size(). Each shard holds a delta
+    // modulo 2^48 in its low bits and, in the top bits, the generation the
+    // delta belongs to, so a writer racing with Clear() cannot revive it.
+    SizeShard size_shards_[kSizeShards];
+    // 8- and 16-bit keys bypass the buckets: one bit per possible key (empty otherwise)
+    detail::AtomicBitmap small_keys_{kSmallKeys ? kSmallKeyRange : 0};
+    // Optional DenseRange: keys in [dense_base_, dense_base_ + dense_size_) live in dense_
+    std::unique_ptr<detail::AtomicBitmap> dense_;
+    uint64_t dense_base_ = 0;
+    uint64_t dense_size_ = 0; // 0: no range, every key goes to the buckets
+
+    /**
+     * @brief Calculates a default power-of-two number of buckets.
+     * Aims for a value significantly larger than hardware concurrency.
+     * @return A power-of-two number of buckets.
+     */
+    static size_t calculate_default_buckets() noexcept {
+        // Start with a reasonable minimum
+        size_t desired_buckets = 128;
+        unsigned int hw_threads = std::thread::hardware_concurrency();
+
+        // If hardware_concurrency is available and reasonable, scale by it
+        if (hw_threads > 0 && hw_threads < (std::numeric_limits<unsigned int>::max() / 16)) {
+             // Multiply by a factor (e.g., 16) to reduce contention per thread
+            desired_buckets = std::max(desired_buckets, static_cast<size_t>(hw_threads * 16));
+        }
+
+        // Find the next power of two >= desired_buckets
+        return detail::next_power_of_two(desired_buckets);
+    }
+
+    static uint64_t make_state(size_t level, size_t split) noexcept {
+        return (static_cast<uint64_t>(level) << kLevelShift) | split;
+    }
+
+    static size_t level_of(uint64_t state) noexcept { return static_cast<size_t>(state >> kLevelShift); }
+    static size_t split_of(uint64_t state) noexcept { return static_cast<size_t>(state & kSplitMask); }
+
+    size_t bucket_count(uint64_t state) const noexcept {
+        return (initial_count_ << level_of(state)) + split_of(state);
+    }
+
+    size_t hash_of(const T& item) const noexcept {
+        return hash_(item);
+    }
+
+    /**
+     * @brief Computes the target bucket index using fast bitwise masking.
+     * Buckets below the split pointer use one more bit of the hash.
+     * @param hash The hashed item.
+     * @param state The layout state to resolve against.
+     * @return The index of the bucket for the item.
+     */
+    size_t hash_to_index(size_t hash, uint64_t state) const noexcept {
+        // The '& (round - 1)' performs a modulo operation as round is a power of two.
+        size_t round = initial_count_ << level_of(state);
+        size_t index = hash & (round - 1);
+        if (index < split_of(state)) index = hash & (round * 2 - 1);
+        return index;
+    }
+
+    /**
+     * @brief Returns the bucket at a given index.
+     * The segment holding it must have been published (index below the
+     * bucket count of an acquired layout state).
+     */
+    BucketType& bucket_at(size_t index) const noexcept {
+        size_t q = index >> log2_initial_;
+        if (q == 0) return segments_[0].load(std::memory_order_acquire)[index];
+        unsigned segment = detail::floor_log2(q) + 1;
+        return segments_[segment].load(std::memory_order_acquire)[index - (initial_count_ << (segment - 1))];
+    }
+
+    /** @brief Returns the lock guarding the bucket at index. */
+    Lock& lock_of(size_t index, BucketType& bucket) const noexcept {
+        return stripes_ ? stripes_[index & stripe_mask_].lock : bucket.lock;
+    }
+
+    /**
+     * @brief Contains with a precomputed hash.
+     * Tries the optimistic path first, then re-checks the layout: a split or
+     * merge may have moved the item after the bucket was picked.
+     */
+    bool contains_hashed(const T& item, size_t hash) const noexcept {
+        uint16_t generation = current_generation();
+        if constexpr (kOptimisticReads) {
+            for (int attempt = 0; attempt < kOptimisticReadAttempts; ++attempt) {
+                size_t index = hash_to_index(hash, state_.load(std::memory_order_acquire));
+                bool exists;
+                if (!bucket_at(index).try_contains_optimistic(item, generation, exists)) break;
+                // A split or merge may have moved the item after we picked the bucket
+                if (hash_to_index(hash, state_.load(std::memory_order_acquire)) == index) return exists;
+            }
+        }
+        LockedBucket locked = lock_bucket<kRead>(hash);
+        bool exists = is_current(locked.bucket, generation) && locked.bucket.data_set.contains(item);
+        detail::unlock_for_read(locked.lock);
+        return exists;
+    }
+
+    /**
+     * @brief Locks and returns the bucket currently responsible for a hash.
+     * The layout is re-checked under the lock: moving an item between buckets
+     * requires holding the lock of the bucket it leaves.
+     * @tparam kForRead Lock with `detail::lock_for_read` instead of exclusively.
+     * @param hash The hashed item whose bucket is needed.
+     * @return The locked bucket; the caller must unlock it the same way.
+     */
+    template <bool kForRead = false>
+    LockedBucket lock_bucket(size_t hash) const noexcept {
+        for (;;) {
+            size_t index = hash_to_index(hash, state_.load(std::memory_order_acquire));
+            BucketType& bucket = bucket_at(index);
+            Lock& lock = lock_of(index, bucket);
+            if constexpr (kForRead) detail::lock_for_read(lock); else lock.lock();
+            if (hash_to_index(hash, state_.load(std::memory_order_acquire)) == index) {
+                return LockedBucket{bucket, lock, index};
+            }
+            // Split or merged meanwhile; retry
+            if constexpr (kForRead) detail::unlock_for_read(lock); else lock.unlock();
+        }
+    }
+
+    /**
+     * @brief Locks two buckets' locks without deadlocking against other pairs.
+     * Locks are taken in address order; a shared stripe is taken once.
+     */
+    static void lock_pair(Lock& a, Lock& b) noexcept {
+        if (&a == &b) {
+            a.lock();
+        } else if (&a < &b) {
+            a.lock();
+            b.lock();
+        } else {
+            b.lock();
+            a.lock();
+        }
+    }
+
+    /** @brief Releases locks taken with `lock_pair`. */
+    static void unlock_pair(Lock& a, Lock& b) noexcept {
+        a.unlock();
+        if (&a != &b) b.unlock();
+    }
+
+    /** @brief Inserts item under its bucket lock; returns true if it was added. */
+    bool insert_locked(const T& item) noexcept {
+        LockedBucket locked = lock_bucket(hash_of(item));
+        BucketType& bucket = locked.bucket;
+        uint16_t generation = current_generation();
+        preserve(bucket, locked.index);
+        refresh(bucket, generation);
+        bucket.begin_write();
+        bool inserted = bucket.data_set.insert(item); // Storage backends ignore duplicates
+        bucket.end_write();
+        locked.lock.unlock();
+        if (inserted) adjust_size(1, kSizeAdd, generation);
+        return inserted;
+    }
+
+    /** @brief Erases item under its bucket lock; returns true if it was present. */
+    bool erase_locked(const T& item) noexcept {
+        LockedBucket locked = lock_bucket(hash_of(item));
+        BucketType& bucket = locked.bucket;
+        uint16_t generation = current_generation();
+        if (!is_current(bucket, generation)) {
+            locked.lock.unlock(); // Cleared: nothing to remove
+            return false;
+        }
+        preserve(bucket, locked.index);
+        bucket.begin_write();
+        bool removed = bucket.data_set.erase(item);
+        bucket.end_write();
+        locked.lock.unlock();
+        if (removed) adjust_size(1, kSizeSubtract, generation);
+        return removed;
+    }
+
+    /**
+     * @brief Stable LSD radix sort of batch entries by bucket index.
+     * Only as many digit passes as the largest index needs are run.
+     */
+    static void partition_by_bucket(std::vector<BatchEntry>& entries, size_t max_index) {
+        std::vector<BatchEntry> scratch(entries.size());
+        constexpr size_t kRadix = size_t{1} << kRadixBits;
+        for (unsigned shift = 0; shift < 64 && (max_index >> shift) != 0; shift += kRadixBits) {
+            size_t offsets[kRadix] = {};
+            for (const BatchEntry& entry : entries) ++offsets[(entry.index >> shift) & (kRadix - 1)];
+            size_t total = 0;
+            for (size_t& offset : offsets) {
+                size_t digit_count = offset;
+                offset = total;
+                total += digit_count;
+            }
+            for (const BatchEntry& entry : entries) scratch[offsets[(entry.index >> shift) & (kRadix - 1)]++] = entry;
+            entries.swap(scratch);
+        }
+    }
+
+    /**
+     * @brief Shared body of InsertBatch/RemoveBatch.
+     * Keys are grouped by their bucket under one layout snapshot. Each group is
+     * applied under a single lock hold; if the layout changed meanwhile, keys
+     * that no longer map to the locked bucket are applied one by one afterwards.
+     * Keys in the `DenseRange` go straight to its bitmap.
+     * @return The number of keys that changed the set.
+     */
+    template <bool kInsert>
+    size_t apply_batch(const T* items, size_t count, uint8_t* changed) {
+        if (count == 0) return 0;
+        uint64_t state = state_.load(std::memory_order_acquire);
+        std::vector<BatchEntry> entries;
+        entries.reserve(count);
+        size_t max_index = 0;
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t offset = dense_offset(items[i]);
+            if (offset < dense_size_) {
+                // DenseRange keys need no partitioning: one atomic RMW each
+                bool done = kInsert ? dense_->insert(offset) : dense_->erase(offset);
+                if (changed != nullptr) changed[i] = done;
+                total += done;
+                continue;
+            }
+            size_t index = hash_to_index(hash_of(items[i]), state);
+            entries.push_back(BatchEntry{index, i});
+            max_index = std::max(max_index, index);
+        }
+        if (entries.empty()) return total;
+        partition_by_bucket(entries, max_index);
+
+        std::vector<size_t> moved; // Positions whose bucket changed under a split or merge
+        for (size_t begin = 0; begin < entries.size();) {
+            size_t index = entries[begin].index;
+            size_t end = begin + 1;
+            while (end < entries.size() && entries[end].index == index) ++end;
+
+            BucketType& bucket = bucket_at(index);
+            Lock& lock = lock_of(index, bucket);
+            lock.lock();
+            uint64_t current = state_.load(std::memory_order_acquire);
+            uint16_t generation = current_generation();
+            preserve(bucket, index);
+            refresh(bucket, generation);
+            size_t group_changed = 0;
+            bucket.begin_write();
+            for (size_t e = begin; e < end; ++e) {
+                size_t position = entries[e].position;
+                const T& item = items[position];
+                if (current != state && hash_to_index(hash_of(item), current) != index) {
+                    moved.push_back(position);
+                    continue;
+                }
+                bool done = kInsert ? bucket.data_set.insert(item) : bucket.data_set.erase(item);
+                if (changed != nullptr) changed[position] = done;
+                group_changed += done;
+            }
+            bucket.end_write();
+            lock.unlock();
+            if (group_changed != 0) adjust_size(group_changed, kInsert, generation);
+            total += group_changed;
+            begin = end;
+        }
+
+        for (size_t position : moved) {
+            bool done = kInsert ? insert_locked(items[position]) : erase_locked(items[position]);
+            if (changed != nullptr) changed[position] = done;
+            total += done;
+        }
+        return total;
+    }
+
+    /** @brief InsertBatch/RemoveBatch for 8- and 16-bit keys: one bitmap RMW per key. */
+    template <bool kInsert>
+    size_t apply_small_batch(const T* items, size_t count, uint8_t* changed) noexcept {
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t bit = small_key_bit(items[i]);
+            bool done = kInsert ? small_keys_.insert(bit) : small_keys_.erase(bit);
+            if (changed != nullptr) changed[i] = done;
+            total += done;
+        }
+        return total;
+    }
+
+    /** @brief Bitmap position of an 8- or 16-bit key, and back. */
+    static size_t small_key_bit(const T& item) noexcept {
+        return static_cast<size_t>(static_cast<std::make_unsigned_t<T>>(item));
+    }
+
+    static T small_key_of(size_t bit) noexcept {
+        return static_cast<T>(static_cast<std::make_unsigned_t<T>>(bit));
+    }
+
+    /** @brief Calls fn(item) for the keys in bitmap words [begin, end). */
+    template <typename Fn>
+    void visit_small_keys(size_t begin, size_t end, Fn& fn) const {
+        small_keys_.for_each(begin, end, [&](size_t bit) { fn(small_key_of(bit)); });
+    }
+
+    /** @brief Position of a key in the `DenseRange` bitmap; >= dense_size_ if outside it. */
+    uint64_t dense_offset(const T& item) const noexcept {
+        return static_cast<uint64_t>(item) - dense_base_;
+    }
+
+    T dense_key_of(uint64_t offset) const noexcept {
+        return static_cast<T>(dense_base_ + offset);
+    }
+
+    /** @brief Calls fn(item) for the keys in `DenseRange` bitmap words [begin, end). */
+    template <typename Fn>
+    void visit_dense(size_t begin, size_t end, Fn& fn) const {
+        dense_->for_each(begin, end, [&](size_t offset) { fn(dense_key_of(offset)); });
+    }
+
+    /**
+     * @brief Freezes the bucket layout for a walk and returns its bucket count.
+     * Waits out an in-flight split or merge; later ones are skipped until
+     * `unpin_layout()`. Several walks may hold pins at once.
+     */
+    size_t pin_layout() const noexcept {
+        resize_lock_.lock();
+        layout_pins_.fetch_add(1, std::memory_order_relaxed);
+        size_t count = bucket_count(state_.load(std::memory_order_relaxed));
+        resize_lock_.unlock();
+        return count;
+    }
+
+    void unpin_layout() const noexcept {
+        layout_pins_.fetch_sub(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Saves a bucket into the running snapshot before its first
+     * modification after the snapshot point. Requires the bucket lock.
+     */
+    void preserve(BucketType& bucket, size_t index) const noexcept {
+        Capture* capture = capture_.load(std::memory_order_seq_cst);
+        // A stale batch may lock a bucket beyond the captured layout; it holds no keys
+        if (capture != nullptr && index < capture->taken.size() && !capture->taken[index]) {
+            capture->take(index, bucket);
+        }
+    }
+
+    /**
+     * @brief `preserve` for a two-bucket update. Both buckets are saved
+     * against one load of the capture pointer, so a snapshot point cannot
+     * fall between them. Requires both bucket locks.
+     */
+    void preserve_pair(BucketType& first, size_t first_index,
+                       BucketType& second, size_t second_index) const noexcept {
+        Capture* capture = capture_.load(std::memory_order_seq_cst);
+        if (capture == nullptr) return;
+        if (first_index < capture->taken.size() && !capture->taken[first_index]) {
+            capture->take(first_index, first);
+        }
+        if (second_index < capture->taken.size() && !capture->taken[second_index]) {
+            capture->take(second_index, second);
+        }
+    }
+
+    /**
+     * @brief Ends a capture. Passes every lock once afterwards, so no writer
+     * that loaded the capture pointer can still be using it when it is freed.
+     */
+    void retire_capture() const noexcept {
+        capture_.store(nullptr, std::memory_order_seq_cst);
+        size_t locks = stripe_mask_ + 1;
+        if (!stripes_) {
+            // Every allocated bucket, including any beyond the layout after merges
+            locks = initial_count_;
+            for (size_t s = 1; s < kMaxSegments && segments_[s].load(std::memory_order_acquire) != nullptr; ++s) {
+                locks = initial_count_ << s;
+            }
+        }
+        for (size_t i = 0; i < locks; ++i) {
+            Lock& lock = stripes_ ? stripes_[i].lock : bucket_at(i).lock;
+            lock.lock();
+            lock.unlock();
+        }
+    }
+
+    /** @brief Calls fn on every item of buckets [begin, end), one bucket lock at a time. */
+    template <typename Fn>
+    void visit_buckets(size_t begin, size_t end, Fn& fn) const {
+        for (size_t i = begin; i < end; ++i) {
+            BucketType& bucket = bucket_at(i);
+            Lock& lock = lock_of(i, bucket);
+            detail::lock_for_read(lock);
+            try {
+                if (is_current(bucket, current_generation())) bucket.data_set.for_each(fn);
+            } catch (...) {
+                detail::unlock_for_read(lock);
+                throw;
+            }
+            detail::unlock_for_read(lock);
+        }
+    }
+
+    /**
+     * @brief Runs visit(begin, end) over chunks of [0, units) on num_threads
+     * workers (0: hardware concurrency), the calling thread being one. Workers
+     * claim chunks from a shared counter. If visit throws, the remaining
+     * chunks are skipped and the first exception is rethrown once all
+     * workers have stopped.
+     */
+    template <typename Visit>
+    static void run_chunked(size_t units, size_t num_threads, Visit&& visit) {
+        if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t chunk = std::max<size_t>(1, units / (num_threads * kChunksPerWorker));
+        std::atomic<size_t> next_unit{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        SpinLock error_lock;
+
+        auto worker = [&]() {
+            try {
+                while (!failed.load(std::memory_order_relaxed)) {
+                    size_t begin = next_unit.fetch_add(chunk, std::memory_order_relaxed);
+                    if (begin >= units) break;
+                    visit(begin, std::min(begin + chunk, units));
+                }
+            } catch (...) {
+                error_lock.lock();
+                if (!error) error = std::current_exception();
+                error_lock.unlock();
+                failed.store(true, std::memory_order_relaxed);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; ++t) {
+            try {
+                workers.emplace_back(worker);
+            } catch (...) {
+                break; // Could not start a thread: carry on with fewer workers
+            }
+        }
+        worker();
+        for (std::thread& thread : workers) thread.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+    /** @brief Caps a worker count so every worker gets at least min_units units. */
+    static size_t set_workers(size_t units, size_t num_threads, size_t min_units = kMinUnitsPerWorker) noexcept {
+        if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+        return std::max<size_t>(1, std::min(num_threads, units / min_units));
+    }
+
+    /**
+     * @brief Whether bucket i of both sets covers the same keys, so they can
+     * be combined pairwise. Both layouts must be pinned; count is this set's.
+     */
+    bool shares_layout(const VelocitySet& other, size_t count) const noexcept {
+        // The bucket index depends only on the hash and the bucket count
+        return count == bucket_count(other.state_.load(std::memory_order_relaxed)) &&
+               detail::same_hash(hash_, other.hash_) &&
+               dense_base_ == other.dense_base_ && dense_size_ == other.dense_size_;
+    }
+
+    /**
+     * @brief UnionWith / IntersectWith / Subtract without the resize check.
+     * @return The number of keys added or removed.
+     */
+    template <SetOperation kOp>
+    size_t combine(const VelocitySet& other, size_t num_threads) {
+        if (&other == this) {
+            if constexpr (kOp != SetOperation::kSubtract) return 0;
+            size_t removed = Size();
+            Clear();
+            return removed;
+        }
+        if constexpr (kSmallKeys) {
+            return combine_words<kOp>(small_keys_, other.small_keys_, 0, small_keys_.word_count());
+        }
+        size_t count = pin_layout();
+        other.pin_layout();
+        if (!shares_layout(other, count)) {
+            other.unpin_layout();
+            unpin_layout();
+            return combine_keys<kOp>(other);
+        }
+        size_t units = count + (dense_size_ != 0 ? dense_->word_count() : 0);
+        std::atomic<size_t> changed{0};
+        try {
+            run_chunked(units, set_workers(units, num_threads), [&](size_t begin, size_t end) {
+                detail::KeyBuffer<T> scratch;
+                size_t local = 0;
+                for (size_t i = begin; i < std::min(end, count); ++i) {
+                    local += combine_bucket<kOp>(other, i, scratch);
+                }
+                if (end > count) {
+                    local += combine_words<kOp>(*dense_, *other.dense_, std::max(begin, count) - count, end - count);
+                }
+                changed.fetch_add(local, std::memory_order_relaxed);
+            });
+        } catch (...) {
+            other.unpin_layout();
+            unpin_layout();
+            throw;
+        }
+        other.unpin_layout();
+        unpin_layout();
+        return changed.load(std::memory_order_relaxed);
+    }
+
+    template <SetOperation kOp>
+    static size_t combine_words(detail::AtomicBitmap& mine, const detail::AtomicBitmap& theirs,
+                                size_t begin, size_t end) noexcept {
+        if constexpr (kOp == SetOperation::kUnion) return mine.unite(theirs, begin, end);
+        if constexpr (kOp == SetOperation::kIntersect) return mine.intersect(theirs, begin, end);
+        return mine.subtract(theirs, begin, end);
+    }
+
+    /**
+     * @brief Combines bucket index of this set with bucket index of a set
+     * sharing its layout. This bucket is locked exclusively and other's for
+     * reading, in address order, so operations running in opposite
+     * directions cannot deadlock.
+     * @param scratch Reused buffer for the keys to remove.
+     * @return The number of keys added or removed.
+     */
+    template <SetOperation kOp>
+    size_t combine_bucket(const VelocitySet& other, size_t index, detail::KeyBuffer<T>& scratch) {
+        BucketType& mine = bucket_at(index);
+        BucketType& theirs = other.bucket_at(index);
+        Lock& my_lock = lock_of(index, mine);
+        Lock& their_lock = other.lock_of(index, theirs);
+        lock_with(my_lock, their_lock);
+        uint16_t generation = current_generation();
+        const Storage<T>* source = is_current(theirs, other.current_generation()) ? &theirs.data_set : nullptr;
+        size_t changed = 0;
+        bool writing = false; // Inside begin_write/end_write: an exception must still close it
+        try {
+            if constexpr (kOp == SetOperation::kUnion) {
+                if (source != nullptr && source->size() != 0) {
+                    preserve(mine, index);
+                    refresh(mine, generation);
+                    mine.begin_write();
+                    writing = true;
+                    source->for_each([&](const T& item) { changed += mine.data_set.insert(item); });
+                    writing = false;
+                    mine.end_write();
+                }
+            } else if (is_current(mine, generation) && mine.data_set.size() != 0) {
+                // Storages cannot erase while iterating: collect the keys first
+                scratch.clear();
+                const Storage<T>& kept = mine.data_set;
+                if constexpr (kOp == SetOperation::kIntersect) {
+                    kept.for_each([&](const T& item) {
+                        if (source == nullptr || !source->contains(item)) scratch.push_back(item);
+                    });
+                } else if (source != nullptr && source->size() < kept.size()) {
+                    source->for_each([&](const T& item) {
+                        if (kept.contains(item)) scratch.push_back(item);
+                    });
+                } else if (source != nullptr) {
+                    kept.for_each([&](const T& item) {
+                        if (source->contains(item)) scratch.push_back(item);
+                    });
+                }
+                if (!scratch.empty()) {
+                    preserve(mine, index);
+                    mine.begin_write();
+                    writing = true;
+                    for (const T& item : scratch) changed += mine.data_set.erase(item);
+                    writing = false;
+                    mine.end_write();
+                }
+            }
+        } catch (...) {
+            if (writing) mine.end_write();
+            unlock_with(my_lock, their_lock);
+            // Keys changed before the failure stay changed: count them
+            if (changed != 0) {
+                adjust_size(changed, kOp == SetOperation::kUnion ? kSizeAdd : kSizeSubtract, generation);
+            }
+            throw;
+        }
+        unlock_with(my_lock, their_lock);
+        if (changed != 0) {
+            adjust_size(changed, kOp == SetOperation::kUnion ? kSizeAdd : kSizeSubtract, generation);
+        }
+        return changed;
+    }
+
+    /**
+     * @brief Appends the keys found in bucket index of both a and b, which
+     * share a layout, to out. Both buckets are locked for reading, in
+     * address order.
+     */
+    static void intersect_bucket(const VelocitySet& a, const VelocitySet& b, size_t index,
+                                 detail::KeyBuffer<T>& out) {
+        BucketType& first = a.bucket_at(index);
+        BucketType& second = b.bucket_at(index);
+        Lock& first_lock = a.lock_of(index, first);
+        Lock& second_lock = b.lock_of(index, second);
+        Lock& low = &first_lock < &second_lock ? first_lock : second_lock;
+        Lock& high = &first_lock < &second_lock ? second_lock : first_lock;
+        detail::lock_for_read(low);
+        detail::lock_for_read(high);
+        try {
+            if (is_current(first, a.current_generation()) && is_current(second, b.current_generation())) {
+                bool first_smaller = first.data_set.size() <= second.data_set.size();
+                const Storage<T>& walked = first_smaller ? first.data_set : second.data_set;
+                const Storage<T>& probed = first_smaller ? second.data_set : first.data_set;
+                walked.for_each([&](const T& item) {
+                    if (probed.contains(item)) out.push_back(item);
+                });
+            }
+        } catch (...) {
+            detail::unlock_for_read(high);
+            detail::unlock_for_read(low);
+            throw;
+        }
+        detail::unlock_for_read(high);
+        detail::unlock_for_read(low);
+    }
+
+    /** @brief Locks mine exclusively and theirs (another set's) for reading, in address order. */
+    static void lock_with(Lock& mine, Lock& theirs) noexcept {
+        if (&mine < &theirs) {
+            mine.lock();
+            detail::lock_for_read(theirs);
+        } else {
+            detail::lock_for_read(theirs);
+            mine.lock();
+        }
+    }
+
+    static void unlock_with(Lock& mine, Lock& theirs) noexcept {
+        detail::unlock_for_read(theirs);
+        mine.unlock();
+    }
+
+    /**
+     * @brief Set algebra for sets with different layouts, through the batch
+     * operations. Subtract walks whichever set is smaller.
+     */
+    template <SetOperation kOp>
+    size_t combine_keys(const VelocitySet& other) {
+        if constexpr (kOp == SetOperation::kUnion) {
+            detail::KeyBuffer<T> keys = other.collect_keys();
+            return InsertBatch(keys.data(), keys.size());
+        } else if constexpr (kOp == SetOperation::kIntersect) {
+            detail::KeyBuffer<T> missing = other.find_keys(collect_keys(), false);
+            return apply_batch<kBatchErase>(missing.data(), missing.size(), nullptr);
+        } else {
+            detail::KeyBuffer<T> keys = Size() < other.Size() ? other.find_keys(collect_keys(), true)
+                                                              : other.collect_keys();
+            return apply_batch<kBatchErase>(keys.data(), keys.size(), nullptr);
+        }
+    }
+
+    /** @brief Copies out every key, as `ForEach` sees them. */
+    detail::KeyBuffer<T> collect_keys() const {
+        detail::KeyBuffer<T> keys;
+        keys.reserve(Size());
+        ForEach([&](const T& item) { keys.push_back(item); });
+        return keys;
+    }
+
+    /** @brief Returns the keys whose presence in this set equals present. */
+    detail::KeyBuffer<T> find_keys(detail::KeyBuffer<T> keys, bool present) const {
+        std::vector<uint8_t> found(keys.size());
+        ContainsBatch(keys.data(), keys.size(), found.data());
+        size_t kept = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if ((found[i] != 0) == present) keys[kept++] = keys[i];
+        }
+        keys.truncate(kept);
+        return keys;
+    }
+
+    /** @brief Writes keys as a T array. `std::vector<bool>` is bit-packed, so bool keys are copied out first. */
+    static bool write_keys(std::FILE* file, const std::vector<T>& keys) {
+        if constexpr (std::is_same_v<T, bool>) {
+            detail::KeyBuffer<T> copy;
+            copy.reserve(keys.size());
+            for (bool key : keys) copy.push_back(key);
+            return std::fwrite(copy.data(), sizeof(T), copy.size(), file) == copy.size();
+        } else {
+            return std::fwrite(keys.data(), sizeof(T), keys.size(), file) == keys.size();
+        }
+    }
+
+    /** @brief Folds the hashes of a few probe keys; equal for policies that place keys alike. */
+    uint64_t hash_fingerprint() const noexcept {
+        static constexpr uint64_t kProbes[] = {0, 1, 2, 3, 0xFF, 0x10000, 0x5BD1E995, 0x9E3779B97F4A7C15};
+        uint64_t fingerprint = 0;
+        for (uint64_t probe : kProbes) {
+            fingerprint = detail::mix_bits(fingerprint ^ hash_of(static_cast<T>(probe)));
+        }
+        return fingerprint;
+    }
+
+    /**
+     * @brief Validates a `SaveTo` file for this key type.
+     * @return The file's header.
+     * @throws std::runtime_error if the file is truncated, inconsistent,
+     *         from a host of the other byte order or for another key type.
+     */
+    static const detail::SetFileHeader& check_file(const detail::MappedFile& file, const std::string& path) {
+        using Header = detail::SetFileHeader;
+        auto invalid = [&](const char* reason) { return std::runtime_error("VelocitySet: " + path + ": " + reason); };
+        if (file.size() < sizeof(Header)) throw invalid("not a VelocitySet file");
+        const Header& header = *reinterpret_cast<const Header*>(file.data());
+        if (header.magic != Header::kMagic) {
+            bool swapped = header.byte_order == 0x04030201;
+            throw invalid(swapped ? "written on a host of the other byte order" : "not a VelocitySet file");
+        }
+        if (header.version != Header::kVersion) throw invalid("unsupported format version");
+        if (header.key_bytes != sizeof(T) || (header.key_signed != 0) != std::is_signed_v<T>) {
+            throw invalid("written for a different key type");
+        }
+        size_t body = file.size() - sizeof(Header);
+        if (header.bucket_count >= body / sizeof(uint64_t)) throw invalid("truncated");
+        size_t key_bytes = body - (header.bucket_count + 1) * sizeof(uint64_t);
+        if (key_bytes % sizeof(T) != 0 || header.key_count != key_bytes / sizeof(T)) throw invalid("truncated");
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(file.data() + sizeof(Header));
+        if (offsets[0] != 0) throw invalid("corrupt bucket offsets");
+        for (size_t i = 0; i < header.bucket_count; ++i) {
+            if (offsets[i + 1] < offsets[i]) throw invalid("corrupt bucket offsets");
+        }
+        if (offsets[header.bucket_count] > header.key_count) throw invalid("corrupt bucket offsets");
+        return header;
+    }
+
+    /**
+     * @brief Splits an empty table up to target buckets ahead of a bulk
+     * load; splitting empty buckets moves nothing.
+     * @return false if a walk has pinned the layout.
+     */
+    bool presize(size_t target) noexcept {
+        resize_lock_.lock();
+        bool unpinned = layout_pins_.load(std::memory_order_relaxed) == 0;
+        while (unpinned && bucket_count(state_.load(std::memory_order_relaxed)) < target) split_one();
+        resize_lock_.unlock();
+        return unpinned;
+    }
+
+    /**
+     * @brief Builds bucket i of this set from bucket group i of a `SaveTo`
+     * file, in parallel. Falls back to `load_keys` unless the table has
+     * exactly count buckets.
+     */
+    size_t load_buckets(const uint64_t* offsets, const T* keys, size_t count, size_t num_threads) {
+        if (pin_layout() != count) {
+            unpin_layout();
+            return load_keys(keys, offsets[count], num_threads);
+        }
+        std::atomic<size_t> added{0};
+        try {
+            run_chunked(count, set_workers(count, num_threads), [&](size_t begin, size_t end) {
+                detail::KeyBuffer<T> strays;
+                size_t local = 0;
+                for (size_t i = begin; i < end; ++i) {
+                    local += load_bucket(i, keys + offsets[i], keys + offsets[i + 1], strays);
+                }
+                if (!strays.empty()) local += InsertBatch(strays.data(), strays.size());
+                added.fetch_add(local, std::memory_order_relaxed);
+            });
+        } catch (...) {
+            unpin_layout();
+            throw;
+        }
+        unpin_layout();
+        return added.load(std::memory_order_relaxed);
+    }
 
-/**
- * @brief Minimalist SpinLock using CPU-relax hints.
- *
- * Uses `_mm_pause()` on x86/x64 to yield execution resources during
- * busy-waiting, reducing power consumption and contention on hyper-threads.
- * Falls back to a simple test-and-set loop if intrinsics are unavailable
- * (though performance may degrade significantly under contention).
- */
-struct SpinLock {
-    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    /**
+     * @brief Inserts [first, last) into bucket index under one lock
+     * acquisition. Keys placed elsewhere by this set's hash policy or
+     * `DenseRange` go to strays instead.
+     * @return The number of keys added.
+     */
+    size_t load_bucket(size_t index, const T* first, const T* last, detail::KeyBuffer<T>& strays) {
+        if (first == last) return 0;
+        BucketType& bucket = bucket_at(index);
+        Lock& lock = lock_of(index, bucket);
+        uint64_t state = state_.load(std::memory_order_relaxed); // Pinned
+        lock.lock();
+        uint16_t generation = current_generation();
+        preserve(bucket, index);
+        refresh(bucket, generation);
+        size_t added = 0;
+        bucket.begin_write();
+        try {
+            for (const T* key = first; key != last; ++key) {
+                if (dense_offset(*key) >= dense_size_ && hash_to_index(hash_of(*key), state) == index) {
+                    added += bucket.data_set.insert(*key);
+                } else {
+                    strays.push_back(*key);
+                }
+            }
+        } catch (...) {
+            bucket.end_write();
+            lock.unlock();
+            if (added != 0) adjust_size(added, kSizeAdd, generation);
+            throw;
+        }
+        bucket.end_write();
+        lock.unlock();
+        if (added != 0) adjust_size(added, kSizeAdd, generation);
+        return added;
+    }
 
-    /** @brief Acquires the lock, spinning until successful. */
-    void lock() noexcept {
-        while (flag.test_and_set(std::memory_order_acquire)) {
-#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
-            _mm_pause(); // Intrinsics for x86/x64
-#else
-            // Basic busy-wait for other architectures or if intrinsics are disabled
-            // Consider std::this_thread::yield() as an alternative,
-            // but its behavior/performance varies widely.
-#endif
+    /** @brief Inserts count keys with `InsertBatch`, in slices spread across workers. */
+    size_t load_keys(const T* keys, size_t count, size_t num_threads) {
+        size_t slices = (count + kLoadSlice - 1) / kLoadSlice;
+        std::atomic<size_t> added{0};
+        run_chunked(slices, set_workers(slices, num_threads, 1), [&](size_t begin, size_t end) {
+            size_t first = begin * kLoadSlice;
+            size_t last = std::min(end * kLoadSlice, count);
+            added.fetch_add(InsertBatch(keys + first, last - first), std::memory_order_relaxed);
+        });
+        return added.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Allocates an empty set configured like this one. */
+    std::unique_ptr<VelocitySet> empty_like() const {
+        size_t lock_stripes = stripes_ ? stripe_mask_ + 1 : kLockPerBucket;
+        if (dense_size_ != 0) {
+            return std::make_unique<VelocitySet>(DenseRange{dense_key_of(0), dense_size_}, initial_count_,
+                                                 max_bucket_load_, hash_, lock_stripes);
         }
+        return std::make_unique<VelocitySet>(initial_count_, max_bucket_load_, hash_, lock_stripes);
     }
 
-    /** @brief Releases the lock. */
-    void unlock() noexcept {
-        flag.clear(std::memory_order_release);
+    /** @brief Returns the current Clear() generation. */
+    uint16_t current_generation() const noexcept {
+        return generation_.load(std::memory_order_acquire);
     }
 
-    // Non-copyable and non-movable
-    SpinLock(const SpinLock&) = delete;
-    SpinLock& operator=(const SpinLock&) = delete;
-    SpinLock() = default; // Ensure default constructor is available
-};
+    static bool is_current(const BucketType& bucket, uint16_t generation) noexcept {
+        return bucket.generation.load(std::memory_order_relaxed) == generation;
+    }
 
+    /**
+     * @brief Discards contents left from before a Clear(), then tags the
+     * bucket with generation. Requires the bucket lock.
+     */
+    static void refresh(BucketType& bucket, uint16_t generation) noexcept {
+        if (is_current(bucket, generation)) return;
+        bucket.begin_write();
+        release_storage(bucket);
+        bucket.generation.store(generation, std::memory_order_relaxed);
+        bucket.end_write();
+    }
 
-/**
- * @brief A cache-line aligned bucket holding a lock and the actual data set.
- *
- * Aligning ensures that different buckets are less likely to cause
- * false sharing cache contention when accessed by different threads/cores.
- *
- * @tparam T The integer key type stored in the set.
- */
-template <typename T>
-struct alignas(kCacheLineSize) Bucket {
-    SpinLock lock;
-    std::unordered_set<T> data_set;
+    /**
+     * @brief Adds or subtracts count on this thread's size shard.
+     * Does nothing if a Clear() has moved on since generation: its reset
+     * already discounted the change.
+     */
+    void adjust_size(size_t count, bool add, uint16_t generation) noexcept {
+        std::atomic<uint64_t>& shard = size_shards_[detail::thread_index() & (kSizeShards - 1)].word;
+        uint64_t delta = add ? count : uint64_t{0} - count;
+        uint64_t word = shard.load(std::memory_order_relaxed);
+        uint64_t desired;
+        do {
+            if ((word >> kSizeGenerationShift) != generation) return;
+            desired = (word & ~kSizeCountMask) | ((word + delta) & kSizeCountMask);
+        } while (!shard.compare_exchange_weak(word, desired, std::memory_order_relaxed));
+    }
 
-    // Default constructor needed for vector initialization
-    Bucket() = default;
+    /**
+     * @brief Throttles resize checks for single-key updates, since summing
+     * the size shards costs a cache line each.
+     * @return The number of resize steps allowed now (0 to skip the check).
+     */
+    static size_t resize_steps(size_t count) noexcept {
+        if (count != 1) return count;
+        static thread_local uint32_t updates = 0;
+        return (++updates % kResizeCheckInterval) == 0 ? kResizeCheckInterval : 0;
+    }
 
-    // Explicitly define move constructor (rule of 5 if others are defined/deleted)
-    // Note: Moving buckets is generally not intended after construction
-    // due to the nature of the hash set, but required by vector sometimes.
-    Bucket(Bucket&& other) noexcept
-        : lock(), // Lock state is not transferred
-          data_set(std::move(other.data_set))
-    {}
+    /** @brief Number of keys in the buckets, from the size shards. See `Size()`. */
+    size_t bucket_size() const noexcept {
+        uint16_t generation = current_generation();
+        uint64_t total = 0;
+        for (const SizeShard& shard : size_shards_) {
+            uint64_t word = shard.word.load(std::memory_order_relaxed);
+            // A shard of another generation is being reset by Clear()
+            if ((word >> kSizeGenerationShift) == generation) total += word & kSizeCountMask;
+        }
+        // Shards hold deltas modulo 2^48 (one thread may remove what another inserted)
+        total &= kSizeCountMask;
+        bool negative = (total >> (kSizeGenerationShift - 1)) != 0; // Transient, under concurrent updates
+        return negative ? 0 : static_cast<size_t>(total);
+    }
 
-    // Explicitly define move assignment operator
-    Bucket& operator=(Bucket&& other) noexcept {
-        if (this != &other) {
-            // Lock state is reset, not transferred
-            data_set = std::move(other.data_set);
+    /** @brief Grows the table while it is over-full, by at most `count` steps. */
+    void maybe_grow(size_t count = 1) noexcept {
+        count = resize_steps(count);
+        if (count == 0) return;
+        size_t size = bucket_size();
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        if (size > bucket_count(state) * max_bucket_load_ && resize_lock_.try_lock()) {
+            if (layout_pins_.load(std::memory_order_relaxed) != 0) count = 0; // Resume after the walk
+            // One step per added key at most, so a batch grows like its single inserts
+            for (size_t step = 0; step < count; ++step) {
+                split_one();
+                state = state_.load(std::memory_order_relaxed);
+                if (bucket_size() <= bucket_count(state) * max_bucket_load_) break;
+            }
+            resize_lock_.unlock();
         }
-        return *this;
     }
 
-    // Prevent copying
-    Bucket(const Bucket&) = delete;
-    Bucket& operator=(const Bucket&) = delete;
+    /** @brief Shrinks the table while it is under-full, by at most `count` steps. */
+    void maybe_shrink(size_t count = 1) noexcept {
+        count = resize_steps(count);
+        if (count == 0) return;
+        size_t size = bucket_size();
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        size_t buckets = bucket_count(state);
+        if (buckets > initial_count_ && size * 4 < buckets * max_bucket_load_ && resize_lock_.try_lock()) {
+            if (layout_pins_.load(std::memory_order_relaxed) != 0) count = 0; // Resume after the walk
+            for (size_t step = 0; step < count; ++step) {
+                merge_one();
+                state = state_.load(std::memory_order_relaxed);
+                buckets = bucket_count(state);
+                if (buckets <= initial_count_ ||
+                    bucket_size() * 4 >= buckets * max_bucket_load_) break;
+            }
+            resize_lock_.unlock();
+        }
+    }
+
+    /** @brief Splits the bucket at the split pointer in two. Requires resize_lock_. */
+    void split_one() noexcept {
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        size_t level = level_of(state);
+        size_t split = split_of(state);
+        if (log2_initial_ + level + 1 >= kMaxSegments - 1) return; // Address space exhausted
+        size_t round = initial_count_ << level;
+        if (split == 0 && segments_[level + 1].load(std::memory_order_relaxed) == nullptr) {
+            // First split of a round: the new buckets go into a fresh segment
+            segments_[level + 1].store(new BucketType[round], std::memory_order_release);
+        }
+
+        BucketType& from = bucket_at(split);
+        BucketType& to = bucket_at(split + round);
+        Lock& from_lock = lock_of(split, from);
+        Lock& to_lock = lock_of(split + round, to);
+        lock_pair(from_lock, to_lock);
+        uint16_t generation = current_generation();
+        refresh(from, generation);
+        refresh(to, generation);
+        from.begin_write();
+        to.begin_write();
+        resize_scratch_.clear();
+        from.data_set.for_each([&](const T& item) {
+            if ((hash_of(item) & (round * 2 - 1)) != split) resize_scratch_.push_back(item);
+        });
+        for (const T& item : resize_scratch_) {
+            from.data_set.erase(item);
+            to.data_set.insert(item);
+        }
+        state_.store(split + 1 == round ? make_state(level + 1, 0) : make_state(level, split + 1),
+                     std::memory_order_release);
+        to.end_write();
+        from.end_write();
+        unlock_pair(from_lock, to_lock);
+    }
+
+    /** @brief Merges the last bucket back into its partner. Requires resize_lock_. */
+    void merge_one() noexcept {
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        size_t level = level_of(state);
+        size_t split = split_of(state);
+        if (split == 0) {
+            if (level == 0) return;
+            // Same layout, expressed as a fully split previous level
+            --level;
+            split = initial_count_ << level;
+        }
+        size_t round = initial_count_ << level;
+
+        BucketType& to = bucket_at(split - 1);
+        BucketType& from = bucket_at(split - 1 + round);
+        Lock& to_lock = lock_of(split - 1, to);
+        Lock& from_lock = lock_of(split - 1 + round, from);
+        lock_pair(to_lock, from_lock);
+        uint16_t generation = current_generation();
+        refresh(to, generation);
+        refresh(from, generation);
+        to.begin_write();
+        from.begin_write();
+        from.data_set.for_each([&](const T& item) { to.data_set.insert(item); });
+        release_storage(from);
+        state_.store(make_state(level, split - 1), std::memory_order_release);
+        from.end_write();
+        to.end_write();
+        unlock_pair(to_lock, from_lock);
+    }
+
+    /**
+     * @brief Empties a bucket that was cleared or left the table.
+     * Frees its memory unless the storage allows optimistic reads: those take
+     * no lock or pin, so a reader may still be probing the storage's tables at
+     * any time, and they are kept (and reused) until the set is destroyed.
+     */
+    static void release_storage(BucketType& bucket) noexcept {
+        if constexpr (kOptimisticReads) {
+            bucket.data_set.clear(); // Keeps the slot arrays and retired tables
+        } else {
+            bucket.data_set = Storage<T>();
+        }
+    }
 };
 
 
 /**
- * @brief VelocitySet: An ultra-fast concurrent set for integer keys.
+ * @brief LockFreeVelocitySet: a lock-free concurrent set for integer keys.
  *
- * Optimizes for high-throughput concurrent access using fine-grained locking,
- * fast hashing, and cache-aware design.
+ * Same public API as `VelocitySet`, but no operation ever waits on another
+ * thread: a preempted thread cannot stall others. Keys live in one flat
+ * open-addressing table of atomic words. `Insert` claims a slot with a single
+ * compare-and-swap; `Remove` swaps the key for a reserved tombstone value,
+ * and tombstones are reused by later inserts.
+ *
+ * The two key values whose bit patterns coincide with the empty (0) and
+ * tombstone (all ones) markers are tracked in dedicated flags instead.
+ *
+ * Racing inserts of the same key can transiently leave it in two slots of
+ * its probe sequence; `Contains` reports any copy and `Remove` clears every
+ * copy, so the set semantics are unaffected.
+ *
+ * Every search stops at an empty slot or after the longest displacement any
+ * insert has needed, whichever comes first. Tombstones left by churn over
+ * many distinct keys therefore never lengthen a search beyond the probe
+ * lengths of the live load, even once no empty slot remains.
+ *
+ * The table does not resize: size it for the maximum number of keys held
+ * at once.
  *
  * @tparam T Must be an integral type (int, uint32_t, size_t, etc.).
  */
 template <typename T>
-class VelocitySet {
-    // Static assertion to ensure T is an integral type
-    static_assert(std::is_integral_v<T>, "VelocitySet requires an integral key type (e.g., int, size_t).");
+class LockFreeVelocitySet {
+    static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>,
+                  "LockFreeVelocitySet requires an integral key type (e.g., int, size_t).");
+    static_assert(std::atomic<std::make_unsigned_t<T>>::is_always_lock_free,
+                  "LockFreeVelocitySet requires lock-free atomics for T.");
 
 public:
+    static constexpr size_t kDefaultCapacity = size_t{1} << 16;
+
     /**
-     * @brief Constructs the concurrent set with a specified number of buckets.
+     * @brief Constructs the set for up to `capacity` keys held at once.
      *
-     * @param bucket_count The desired number of buckets. **Must be a power of two**
-     *                     for the fast bitwise hashing to work correctly. If 0 is
-     *                     passed, a default power-of-two size is calculated based
-     *                     on hardware concurrency.
-     * @throws std::invalid_argument if bucket_count is non-zero and not a power of two.
+     * @param capacity Maximum number of keys held at once; any number of
+     *                 distinct keys may pass through over time. Twice as many
+     *                 slots (rounded up to a power of two) are allocated to
+     *                 keep probe sequences short. If 0, `kDefaultCapacity`.
      */
-    explicit VelocitySet(size_t bucket_count = 0)
+    explicit LockFreeVelocitySet(size_t capacity = 0)
     {
-        if (bucket_count == 0) {
-            buckets_count_ = calculate_default_buckets();
-        } else {
-            if (!is_power_of_two(bucket_count)) {
-                throw std::invalid_argument("VelocitySet: bucket_count must be a power of two.");
-            }
-            buckets_count_ = bucket_count;
-        }
-        // The mask relies on buckets_count_ being a power of two
-        bucket_mask_ = buckets_count_ - 1;
-        // Initialize the buckets vector
-        buckets_.resize(buckets_count_);
+        if (capacity == 0) capacity = kDefaultCapacity;
+        slot_count_ = detail::next_power_of_two(capacity * 2);
+        slot_mask_ = slot_count_ - 1;
+        slots_.reset(new std::atomic<Word>[slot_count_]);
+        for (size_t i = 0; i < slot_count_; ++i) slots_[i].store(kEmpty, std::memory_order_relaxed);
     }
 
     /**
-     * @brief Inserts an item into the set (thread-safe).
+     * @brief Inserts an item into the set (thread-safe, lock-free).
      * @param item The integer item to insert.
+     * @throws std::length_error if every slot holds a live key.
      */
-    void Insert(const T& item) noexcept {
-        Bucket<T>& bucket = get_bucket(item);
-        bucket.lock.lock();
-        bucket.data_set.insert(item); // std::unordered_set handles duplicates
-        bucket.lock.unlock();
+    void Insert(const T& item) {
+        Word key = static_cast<Word>(item);
+        if (key == kEmpty || key == kTombstone) {
+            reserved_flag(key).store(true, std::memory_order_release);
+            return;
+        }
+        for (;;) {
+            size_t limit = probe_limit();
+            size_t tombstone = slot_count_; // sentinel: none seen
+            size_t tombstone_probes = 0;
+            size_t i = home_slot(key);
+            size_t probes = 0;
+            bool ended = false;
+            for (; probes < limit; ++probes, i = (i + 1) & slot_mask_) {
+                Word w = slots_[i].load(std::memory_order_acquire);
+                if (w == key) return; // Already present
+                if (w == kEmpty) {
+                    ended = true;
+                    break;
+                }
+                if (w == kTombstone && tombstone == slot_count_) {
+                    tombstone = i;
+                    tombstone_probes = probes;
+                }
+            }
+            // The key is absent up to the end of its probe sequence: claim the
+            // first tombstone, or the empty slot that ended the probe.
+            size_t target = i;
+            Word expected = kEmpty;
+            if (tombstone != slot_count_) {
+                target = tombstone;
+                probes = tombstone_probes;
+                expected = kTombstone;
+            } else if (!ended) {
+                // Every slot within the limit is live: the key goes further out
+                for (; probes < slot_count_; ++probes, i = (i + 1) & slot_mask_) {
+                    expected = slots_[i].load(std::memory_order_acquire);
+                    if (expected == key) return;
+                    if (expected == kEmpty || expected == kTombstone) break;
+                }
+                if (probes == slot_count_) {
+                    throw std::length_error("LockFreeVelocitySet: every slot holds a live key.");
+                }
+                target = i;
+            }
+            raise_probe_limit(probes + 1); // Before the key becomes visible
+            if (slots_[target].compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+                if (expected == kTombstone) remove_copies_after(target, key);
+                return;
+            }
+            // Lost the slot to a concurrent writer; rescan.
+        }
     }
 
     /**
-     * @brief Removes an item from the set (thread-safe).
+     * @brief Removes an item from the set (thread-safe, lock-free).
      * @param item The integer item to remove.
      */
     void Remove(const T& item) noexcept {
-        Bucket<T>& bucket = get_bucket(item);
-        bucket.lock.lock();
-        bucket.data_set.erase(item);
-        bucket.lock.unlock();
+        Word key = static_cast<Word>(item);
+        if (key == kEmpty || key == kTombstone) {
+            reserved_flag(key).store(false, std::memory_order_release);
+            return;
+        }
+        size_t limit = probe_limit();
+        size_t i = home_slot(key);
+        for (size_t probes = 0; probes < limit; ++probes, i = (i + 1) & slot_mask_) {
+            Word w = slots_[i].load(std::memory_order_acquire);
+            if (w == kEmpty) break;
+            if (w == key) {
+                slots_[i].compare_exchange_strong(w, kTombstone, std::memory_order_acq_rel);
+            }
+        }
     }
 
     /**
-     * @brief Checks if an item exists in the set (thread-safe).
+     * @brief Checks if an item exists in the set (thread-safe, lock-free).
      * @param item The integer item to check for.
      * @return true if the item is present, false otherwise.
      */
-    bool Contains(const T& item) noexcept {
-        Bucket<T>& bucket = get_bucket(item);
-        bucket.lock.lock();
-        // Use count for potentially faster check than find != end in some impls
-        bool exists = (bucket.data_set.count(item) > 0);
-        bucket.lock.unlock();
-        return exists;
+    bool Contains(const T& item) const noexcept {
+        Word key = static_cast<Word>(item);
+        if (key == kEmpty || key == kTombstone) {
+            return reserved_flag(key).load(std::memory_order_acquire);
+        }
+        size_t limit = probe_limit();
+        size_t i = home_slot(key);
+        for (size_t probes = 0; probes < limit; ++probes, i = (i + 1) & slot_mask_) {
+            Word w = slots_[i].load(std::memory_order_acquire);
+            if (w == key) return true;
+            if (w == kEmpty) break;
+        }
+        return false;
     }
 
     /**
-     * @brief Returns the number of buckets being used.
-     * @return The number of buckets (always a power of two).
+     * @brief Looks up many items at once, prefetching the home slots of a
+     * group of keys before probing any of them (thread-safe, lock-free).
+     * @param items The items to look up.
+     * @param count Number of items.
+     * @param out out[i] is set to 1 if items[i] is present, 0 otherwise.
+     * @return The number of items found.
      */
-    size_t GetBucketCount() const noexcept {
-        return buckets_count_;
+    size_t ContainsBatch(const T* items, size_t count, uint8_t* out) const noexcept {
+        constexpr size_t kGroupSize = 16;
+        size_t found = 0;
+        for (size_t begin = 0; begin < count; begin += kGroupSize) {
+            size_t group = std::min(kGroupSize, count - begin);
+            for (size_t g = 0; g < group; ++g) {
+                detail::prefetch(&slots_[home_slot(static_cast<Word>(items[begin + g]))]);
+            }
+            for (size_t g = 0; g < group; ++g) {
+                bool exists = Contains(items[begin + g]);
+                out[begin + g] = exists;
+                found += exists;
+            }
+        }
+        return found;
+    }
+
+    /**
+     * @brief Returns the number of slots in the table.
+     * @return The slot count (always a power of two).
+     */
+    size_t GetSlotCount() const noexcept {
+        return slot_count_;
     }
 
     /**
-     * @brief Clears all elements from the set (thread-safe, potentially blocking).
-     * Note: This acquires locks on *all* buckets sequentially. Avoid calling
-     * concurrently with heavy insert/remove/contains operations if possible.
+     * @brief Clears all elements from the set.
+     * Note: Slots are reset one by one, so `Insert` and `Remove` must not run
+     * concurrently: emptying a slot in front of a key placed by a racing
+     * insert would leave that key counted but unreachable. Concurrent
+     * `Contains` calls are safe and see each key either present or cleared.
+     * The search bound is kept, not reset, so it stays valid for every slot.
      */
     void Clear() noexcept {
-        for (size_t i = 0; i < buckets_count_; ++i) {
-            buckets_[i].lock.lock();
-            buckets_[i].data_set.clear();
-            buckets_[i].lock.unlock(); // Release lock immediately after clearing bucket
-        }
+        for (size_t i = 0; i < slot_count_; ++i) slots_[i].store(kEmpty, std::memory_order_release);
+        has_empty_key_.store(false, std::memory_order_release);
+        has_tombstone_key_.store(false, std::memory_order_release);
     }
 
     /**
      * @brief Returns the approximate total number of elements in the set.
-     * Note: This is potentially expensive and provides only an estimate if
-     * called concurrently with modifications, as it locks buckets sequentially.
-     * Use primarily for debugging or diagnostics.
+     * Note: Scans every slot, and is only an estimate if called concurrently
+     * with modifications. Use primarily for debugging or diagnostics.
      * @return Approximate number of elements.
      */
-    size_t GetApproximateSize() noexcept {
+    size_t GetApproximateSize() const noexcept {
         size_t total_size = 0;
-        for (size_t i = 0; i < buckets_count_; ++i) {
-            buckets_[i].lock.lock();
-            total_size += buckets_[i].data_set.size();
-            buckets_[i].lock.unlock();
+        for (size_t i = 0; i < slot_count_; ++i) {
+            Word w = slots_[i].load(std::memory_order_relaxed);
+            total_size += (w != kEmpty && w != kTombstone);
         }
+        total_size += has_empty_key_.load(std::memory_order_relaxed);
+        total_size += has_tombstone_key_.load(std::memory_order_relaxed);
         return total_size;
     }
 
-
 private:
-    std::vector<Bucket<T>> buckets_;
-    size_t buckets_count_; // Store the count (power of two)
-    size_t bucket_mask_;   // Cache mask for hashing (bucket_count - 1)
+    using Word = std::make_unsigned_t<T>;
+    static constexpr Word kEmpty = 0;
+    static constexpr Word kTombstone = static_cast<Word>(~Word{0});
 
-    /**
-     * @brief Calculates a default power-of-two number of buckets.
-     * Aims for a value significantly larger than hardware concurrency.
-     * @return A power-of-two number of buckets.
-     */
-    static size_t calculate_default_buckets() noexcept {
-        // Start with a reasonable minimum
-        size_t desired_buckets = 128;
-        unsigned int hw_threads = std::thread::hardware_concurrency();
+    std::unique_ptr<std::atomic<Word>[]> slots_;
+    size_t slot_count_; // Power of two
+    size_t slot_mask_;  // slot_count_ - 1
+    std::atomic<bool> has_empty_key_{false};     // Membership of the key encoded as kEmpty
+    std::atomic<bool> has_tombstone_key_{false}; // Membership of the key encoded as kTombstone
+    // Longest probe (in slots) any insert has needed; bounds every search. Only grows. Read-mostly
+    alignas(kCacheLineSize) std::atomic<size_t> max_probe_{1};
 
-        // If hardware_concurrency is available and reasonable, scale by it
-        if (hw_threads > 0 && hw_threads < (std::numeric_limits<unsigned int>::max() / 16)) {
-             // Multiply by a factor (e.g., 16) to reduce contention per thread
-            desired_buckets = std::max(desired_buckets, static_cast<size_t>(hw_threads * 16));
+    size_t home_slot(Word key) const noexcept {
+        return static_cast<size_t>(detail::mix_bits(static_cast<uint64_t>(key))) & slot_mask_;
+    }
+
+    std::atomic<bool>& reserved_flag(Word key) noexcept {
+        return key == kEmpty ? has_empty_key_ : has_tombstone_key_;
+    }
+
+    const std::atomic<bool>& reserved_flag(Word key) const noexcept {
+        return key == kEmpty ? has_empty_key_ : has_tombstone_key_;
+    }
+
+    /** @brief Number of slots a search may probe from a key's home slot. */
+    size_t probe_limit() const noexcept {
+        return std::min(max_probe_.load(std::memory_order_acquire), slot_count_);
+    }
+
+    /** @brief Raises the search bound to at least probes; never lowers it. */
+    void raise_probe_limit(size_t probes) noexcept {
+        size_t current = max_probe_.load(std::memory_order_relaxed);
+        while (current < probes &&
+               !max_probe_.compare_exchange_weak(current, probes, std::memory_order_seq_cst)) {
         }
+    }
 
-        // Find the next power of two >= desired_buckets
-        return next_power_of_two(desired_buckets);
+    /**
+     * @brief Tombstones copies of key later in the probe sequence than `slot`.
+     * A racing insert may have claimed a later empty slot for the same key
+     * while this thread reused an earlier tombstone.
+     */
+    void remove_copies_after(size_t slot, Word key) noexcept {
+        size_t home = home_slot(key);
+        size_t distance = (slot - home) & slot_mask_;
+        size_t limit = probe_limit(); // Covers every copy: each raised it before appearing
+        size_t remaining = limit > distance + 1 ? limit - 1 - distance : 0;
+        for (size_t i = (slot + 1) & slot_mask_; remaining > 0; --remaining, i = (i + 1) & slot_mask_) {
+            Word w = slots_[i].load(std::memory_order_acquire);
+            if (w == kEmpty) break;
+            if (w == key) {
+                slots_[i].compare_exchange_strong(w, kTombstone, std::memory_order_acq_rel);
+            }
+        }
     }
+};
+
+
+#if defined(VELOCITY_POSIX_FILES)
+
+/**
+ * @brief DurableVelocitySet: a VelocitySet whose updates survive crashes.
+ *
+ * Every `Insert`/`Remove` that changes the set is recorded in a write-ahead
+ * log in the set's directory before the call returns. The log is sharded by
+ * key, each shard with its own mutex and file, so writers of different keys
+ * rarely meet. Appends are group-committed: a writer adds its record to the
+ * shard's buffer, and the first writer to find no flush running writes the
+ * whole buffer and calls `fdatasync` once for every record appended
+ * meanwhile. Writers arriving during a flush join the next one.
+ *
+ * `Checkpoint()` saves the set with `SaveTo` and deletes the logs it covers.
+ * Construction loads the latest checkpoint, then replays the logs. All
+ * records for one key go to one shard, in order, so the shards replay
+ * independently. A record torn by a crash ends its log.
+ *
+ * An update is visible to readers as soon as it is applied, slightly before
+ * it is durable. Read-only access to the full `VelocitySet` API goes
+ * through `Set()`. Requires POSIX file I/O.
+ *
+ * @tparam T, Storage, Hash, Lock As for `VelocitySet`.
+ */
+template <typename T,
+          template <typename> class Storage = UnorderedSetStorage,
+          typename Hash = IdentityHash,
+          typename Lock = SpinLock>
+class DurableVelocitySet {
+public:
+    using SetType = VelocitySet<T, Storage, Hash, Lock>;
 
     /**
-     * @brief Finds the smallest power of two greater than or equal to n.
-     * @param n The input number.
-     * @return The next power of two. Returns 1 if n is 0.
+     * @brief Opens the durable set stored in directory, creating it if needed.
+     *
+     * @param directory Holds the checkpoint and the log files.
+     * @param log_shards Number of log shards. If 0, the hardware concurrency
+     *                   rounded up to a power of two. Otherwise **must be a
+     *                   power of two**. May change between runs.
+     * @param bucket_count, max_bucket_load, hash As for `VelocitySet`.
+     * @throws std::invalid_argument if log_shards or bucket_count is not a power of two.
+     * @throws std::system_error if the directory or its files cannot be accessed.
+     * @throws std::runtime_error if a checkpoint or log holds another key type.
      */
-    static size_t next_power_of_two(size_t n) noexcept {
-        if (n == 0) return 1;
-        // Efficient bit manipulation way:
-        n--;
-        n |= n >> 1;
-        n |= n >> 2;
-        n |= n >> 4;
-        n |= n >> 8;
-        n |= n >> 16;
-        if constexpr (sizeof(size_t) > 4) { // Handle 64-bit size_t
-             n |= n >> 32;
+    explicit DurableVelocitySet(const std::string& directory, size_t log_shards = 0, size_t bucket_count = 0,
+                                size_t max_bucket_load = 0, const Hash& hash = Hash())
+        : set_(bucket_count, max_bucket_load, hash), directory_(directory)
+    {
+        if (log_shards == 0) {
+            log_shards = detail::next_power_of_two(std::max(1u, std::thread::hardware_concurrency()));
+        } else if (!detail::is_power_of_two(log_shards)) {
+            throw std::invalid_argument("DurableVelocitySet: log_shards must be a power of two.");
         }
-        n++;
-        return n;
+        shards_.reset(new LogShard[log_shards]);
+        shard_mask_ = log_shards - 1;
+        if (::mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), "DurableVelocitySet: cannot create " + directory_);
+        }
+        recover();
+        std::vector<int> files = create_logs(epoch_ + 1);
+        for (size_t s = 0; s <= shard_mask_; ++s) shards_[s].fd = files[s];
+        ++epoch_;
+    }
 
-        // Alternative using floating point (potentially slightly less performant/precise for edge cases):
-        // if (n == 0) return 1;
-        // return static_cast<size_t>(1) << static_cast<size_t>(std::ceil(std::log2(static_cast<double>(n))));
+    ~DurableVelocitySet() {
+        for (size_t s = 0; s <= shard_mask_; ++s) {
+            if (shards_[s].fd >= 0) ::close(shards_[s].fd);
+        }
     }
 
+    // Non-copyable and non-movable
+    DurableVelocitySet(const DurableVelocitySet&) = delete;
+    DurableVelocitySet& operator=(const DurableVelocitySet&) = delete;
+
+    /**
+     * @brief Inserts an item; it is durable when the call returns (thread-safe).
+     * @throws std::system_error if the log cannot be written. The item may
+     *         then be in the set without being durable, and later updates
+     *         logged to the same shard fail too.
+     */
+    void Insert(const T& item) { TryInsert(item); }
+
+    /** @brief Removes an item; durable when the call returns (thread-safe). See `Insert`. */
+    void Remove(const T& item) { TryRemove(item); }
+
+    /** @brief Like `Insert`. @return true if the item was added (and logged). */
+    bool TryInsert(const T& item) { return update(item, kInsertRecord); }
+
+    /** @brief Like `Remove`. @return true if the item was removed (and logged). */
+    bool TryRemove(const T& item) { return update(item, kRemoveRecord); }
+
+    bool Contains(const T& item) const noexcept { return set_.Contains(item); }
+
+    size_t Size() const noexcept { return set_.Size(); }
+
+    /** @brief The underlying set, for read-only operations (ForEach, Snapshot, ...). */
+    const SetType& Set() const noexcept { return set_; }
+
     /**
-     * @brief Checks if a number is a power of two.
-     * @param n The number to check.
-     * @return true if n is > 0 and a power of two, false otherwise.
+     * @brief Saves the set with `SaveTo` and deletes the logs it covers (thread-safe).
+     * Updates keep running. Each log shard is flushed and switched to a new
+     * file before the set is captured, so the checkpoint holds every record
+     * of the old files. Records in the new files may or may not be in it;
+     * replaying them over it gives the same set either way, since each key
+     * ends in the state of its last record.
+     * @throws std::system_error if a file cannot be written.
      */
-    static bool is_power_of_two(size_t n) noexcept {
-        return (n > 0) && ((n & (n - 1)) == 0);
+    void Checkpoint() {
+        std::lock_guard<std::mutex> serial(checkpoint_mutex_);
+        uint64_t epoch = epoch_ + 1;
+        std::vector<int> files = create_logs(epoch);
+        for (size_t s = 0; s <= shard_mask_; ++s) {
+            LogShard& shard = shards_[s];
+            std::unique_lock<std::mutex> guard(shard.mutex);
+            for (;;) {
+                if (shard.flushing) {
+                    shard.flushed.wait(guard);
+                } else if (!shard.pending.empty()) {
+                    flush(shard, guard);
+                } else {
+                    break;
+                }
+            }
+            int old = shard.fd;
+            shard.fd = files[s];
+            guard.unlock();
+            ::close(old);
+        }
+        epoch_ = epoch;
+        set_.SaveTo(path_of(kCheckpointName)); // Also syncs the directory
+        for (const auto& log : list_logs()) {
+            if (log.first < epoch) ::unlink(log.second.c_str()); // A leftover is replayed harmlessly
+        }
+    }
+
+private:
+    static constexpr uint32_t kInsertRecord = 1;
+    static constexpr uint32_t kRemoveRecord = 2;
+    static constexpr uint64_t kLogMagic = 0x4C41574C434F4C56; // "VLOCLWAL"
+    static constexpr uint32_t kLogVersion = 1;
+    static constexpr uint64_t kRecordSalt = 0x243F6A8885A308D3;
+    static constexpr const char* kCheckpointName = "checkpoint.vset";
+
+    /** @brief Start of every log file. */
+    struct LogHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint16_t key_bytes;
+        uint16_t key_signed;
+    };
+    static_assert(sizeof(LogHeader) == 16, "LogHeader must stay 16 bytes");
+
+    /** @brief One logged update; check detects a record torn by a crash. */
+    struct LogRecord {
+        uint64_t key;
+        uint32_t op;
+        uint32_t check;
+    };
+    static_assert(sizeof(LogRecord) == 16, "LogRecord must stay 16 bytes");
+
+    /** @brief One log file with its group-commit state, alone on its cache lines. */
+    struct alignas(kCacheLineSize) LogShard {
+        std::mutex mutex;
+        std::condition_variable flushed;
+        std::vector<LogRecord> pending; // Appended, not yet written
+        std::vector<LogRecord> writing; // The batch being flushed
+        uint64_t appended = 0;          // Records appended so far
+        uint64_t durable = 0;           // Records written and synced so far
+        bool flushing = false;
+        int error = 0;                  // errno of a failed flush; sticky
+        int fd = -1;
+    };
+
+    /** @brief Applies and logs an update under its shard's mutex, then waits for the group commit. */
+    bool update(const T& item, uint32_t op) {
+        LogShard& shard = shards_[detail::mix_bits(static_cast<uint64_t>(item)) & shard_mask_];
+        std::unique_lock<std::mutex> guard(shard.mutex);
+        throw_if_failed(shard);
+        shard.pending.push_back(make_record(static_cast<uint64_t>(item), op)); // Before applying: may throw
+        bool changed = op == kInsertRecord ? set_.TryInsert(item) : set_.TryRemove(item);
+        if (!changed) {
+            shard.pending.pop_back();
+            return false;
+        }
+        uint64_t sequence = ++shard.appended;
+        while (shard.durable < sequence && shard.error == 0) {
+            if (shard.flushing) {
+                shard.flushed.wait(guard);
+            } else {
+                flush(shard, guard);
+            }
+        }
+        throw_if_failed(shard);
+        return true;
     }
 
     /**
-     * @brief Computes the target bucket index using fast bitwise masking.
-     * Relies on `buckets_count_` being a power of two.
-     * @param item The item to hash.
-     * @return The index of the bucket for the item.
+     * @brief Writes and syncs every pending record of a shard. The shard
+     * mutex is released during the I/O so other writers can queue records
+     * for the next flush.
      */
-    size_t hash_to_index(const T& item) const noexcept {
-        // Cast to size_t for bitwise operation. Handles signed/unsigned T.
-        // The '& bucket_mask_' performs a modulo operation when bucket_mask_ is (power_of_two - 1).
-        return static_cast<size_t>(item) & bucket_mask_;
+    static void flush(LogShard& shard, std::unique_lock<std::mutex>& guard) {
+        shard.flushing = true;
+        shard.writing.swap(shard.pending);
+        uint64_t sequence = shard.appended;
+        int fd = shard.fd; // Only swapped by Checkpoint, which waits for flushes
+        guard.unlock();
+        int error = write_all(fd, shard.writing.data(), shard.writing.size() * sizeof(LogRecord));
+        if (error == 0) error = sync_data(fd);
+        guard.lock();
+        shard.writing.clear();
+        shard.flushing = false;
+        if (error != 0) {
+            shard.error = error;
+        } else {
+            shard.durable = sequence;
+        }
+        shard.flushed.notify_all();
+    }
+
+    void throw_if_failed(const LogShard& shard) const {
+        if (shard.error != 0) {
+            throw std::system_error(shard.error, std::generic_category(),
+                                    "DurableVelocitySet: cannot write the log in " + directory_);
+        }
+    }
+
+    static LogRecord make_record(uint64_t key, uint32_t op) noexcept {
+        return LogRecord{key, op, record_check(key, op)};
+    }
+
+    static uint32_t record_check(uint64_t key, uint32_t op) noexcept {
+        return static_cast<uint32_t>(detail::mix_bits(key ^ kRecordSalt ^ (static_cast<uint64_t>(op) << 56)));
+    }
+
+    /** @brief Loads the checkpoint, then replays the logs oldest epoch first. */
+    void recover() {
+        remove_temp_files();
+        if (::access(path_of(kCheckpointName).c_str(), F_OK) == 0) set_.LoadFrom(path_of(kCheckpointName));
+        std::vector<std::pair<uint64_t, std::string>> logs = list_logs();
+        // Within an epoch a key's records are all in one shard, so only epochs need ordering
+        std::sort(logs.begin(), logs.end());
+        for (const auto& log : logs) replay(log.second);
+        epoch_ = logs.empty() ? 0 : logs.back().first;
+    }
+
+    /** @brief Applies a log file's records up to the first torn one. */
+    void replay(const std::string& path) {
+        detail::MappedFile file(path);
+        if (file.size() < sizeof(LogHeader)) return; // Torn at creation: nothing was logged
+        const LogHeader& header = *reinterpret_cast<const LogHeader*>(file.data());
+        if (header.magic != kLogMagic || header.version != kLogVersion) {
+            throw std::runtime_error("DurableVelocitySet: " + path + ": not a log file");
+        }
+        if (header.key_bytes != sizeof(T) || (header.key_signed != 0) != std::is_signed_v<T>) {
+            throw std::runtime_error("DurableVelocitySet: " + path + ": written for a different key type");
+        }
+        const LogRecord* records = reinterpret_cast<const LogRecord*>(file.data() + sizeof(LogHeader));
+        size_t count = (file.size() - sizeof(LogHeader)) / sizeof(LogRecord);
+        for (size_t i = 0; i < count; ++i) {
+            const LogRecord& record = records[i];
+            if (record.check != record_check(record.key, record.op)) break;
+            T item = static_cast<T>(record.key);
+            if (record.op == kInsertRecord) {
+                set_.Insert(item);
+            } else if (record.op == kRemoveRecord) {
+                set_.Remove(item);
+            }
+        }
+    }
+
+    /** @brief Creates one empty log file per shard for epoch and syncs them into the directory. */
+    std::vector<int> create_logs(uint64_t epoch) {
+        std::vector<int> files;
+        files.reserve(shard_mask_ + 1);
+        LogHeader header{kLogMagic, kLogVersion, static_cast<uint16_t>(sizeof(T)),
+                         static_cast<uint16_t>(std::is_signed_v<T>)};
+        for (size_t s = 0; s <= shard_mask_; ++s) {
+            std::string path = path_of("log-" + std::to_string(epoch) + "-" + std::to_string(s) + ".wal");
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+            int error = fd < 0 ? errno : write_all(fd, &header, sizeof(header));
+            if (error == 0) error = sync_data(fd);
+            if (error != 0) {
+                if (fd >= 0) ::close(fd);
+                for (int file : files) ::close(file);
+                throw std::system_error(error, std::generic_category(), "DurableVelocitySet: cannot create " + path);
+            }
+            files.push_back(fd);
+        }
+        sync_directory();
+        return files;
+    }
+
+    /** @brief Makes created, renamed and removed directory entries durable. */
+    void sync_directory() const {
+        int fd = ::open(directory_.c_str(), O_RDONLY | O_CLOEXEC);
+        int error = fd < 0 ? errno : (::fsync(fd) == 0 ? 0 : errno);
+        if (fd >= 0) ::close(fd);
+        if (error != 0) {
+            throw std::system_error(error, std::generic_category(), "DurableVelocitySet: cannot sync " + directory_);
+        }
+    }
+
+    /** @brief Calls fn with the name of every entry in the directory. */
+    template <typename Fn>
+    void for_each_entry(Fn&& fn) const {
+        DIR* dir = ::opendir(directory_.c_str());
+        if (dir == nullptr) {
+            throw std::system_error(errno, std::generic_category(), "DurableVelocitySet: cannot list " + directory_);
+        }
+        try {
+            while (const dirent* entry = ::readdir(dir)) fn(entry->d_name);
+        } catch (...) {
+            ::closedir(dir);
+            throw;
+        }
+        ::closedir(dir);
+    }
+
+    /** @brief Returns (epoch, path) for every log file in the directory. */
+    std::vector<std::pair<uint64_t, std::string>> list_logs() const {
+        std::vector<std::pair<uint64_t, std::string>> logs;
+        for_each_entry([&](const char* name) {
+            uint64_t epoch;
+            if (parse_log_name(name, epoch)) logs.emplace_back(epoch, path_of(name));
+        });
+        return logs;
+    }
+
+    /** @brief Removes checkpoint temporaries left by a crash inside `SaveTo`. */
+    void remove_temp_files() const {
+        std::string prefix = std::string(kCheckpointName) + ".tmp.";
+        for_each_entry([&](const char* name) {
+            if (std::strncmp(name, prefix.c_str(), prefix.size()) == 0) ::unlink(path_of(name).c_str());
+        });
     }
 
     /**
-     * @brief Gets a reference to the appropriate bucket for a given item.
-     * @param item The item whose bucket is needed.
-     * @return A non-const reference to the Bucket.
+     * @brief Parses "log-<epoch>-<shard>.wal"; any other name, e.g. "log-1-2.tmp"
+     * or "log-+1-2.wal", is not a log.
      */
-    Bucket<T>& get_bucket(const T& item) noexcept {
-        return buckets_[hash_to_index(item)];
+    static bool parse_log_name(const char* name, uint64_t& epoch) noexcept {
+        uint64_t parsed_epoch, shard;
+        if (std::strncmp(name, "log-", 4) != 0) return false;
+        name += 4;
+        if (!parse_number(name, parsed_epoch) || *name++ != '-' || !parse_number(name, shard)) return false;
+        if (std::strcmp(name, ".wal") != 0) return false;
+        epoch = parsed_epoch;
+        return true;
     }
 
     /**
-     * @brief Gets a const reference to the appropriate bucket for a given item.
-     * (Currently unused publicly, but good practice to have)
-     * @param item The item whose bucket is needed.
-     * @return A const reference to the Bucket.
+     * @brief Parses the decimal digits at text and advances past them. Unlike
+     * sscanf, accepts no whitespace or sign.
+     * @return false if there are no digits or they overflow 64 bits.
      */
-    // const Bucket<T>& get_bucket(const T& item) const noexcept {
-    //     return buckets_[hash_to_index(item)];
-    // }
+    static bool parse_number(const char*& text, uint64_t& value) noexcept {
+        if (*text < '0' || *text > '9') return false;
+        value = 0;
+        for (; *text >= '0' && *text <= '9'; ++text) {
+            uint64_t digit = static_cast<uint64_t>(*text - '0');
+            if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+
+    /** @brief Writes all of data, retrying short and interrupted writes. @return 0 or errno. */
+    static int write_all(int fd, const void* data, size_t size) noexcept {
+        const char* bytes = static_cast<const char*>(data);
+        while (size != 0) {
+            ssize_t written = ::write(fd, bytes, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return 0;
+    }
+
+    static int sync_data(int fd) noexcept {
+#if defined(__linux__)
+        return ::fdatasync(fd) == 0 ? 0 : errno;
+#else
+        return ::fsync(fd) == 0 ? 0 : errno;
+#endif
+    }
+
+    std::string path_of(const std::string& name) const {
+        return directory_ + "/" + name;
+    }
+
+    SetType set_;
+    std::string directory_;
+    std::unique_ptr<LogShard[]> shards_;
+    size_t shard_mask_ = 0;
+    uint64_t epoch_ = 0;            // Epoch of the current log files
+    std::mutex checkpoint_mutex_;   // Serializes Checkpoint() calls
 };
 
+#endif // VELOCITY_POSIX_FILES
+
 } // namespace velocity
 
 #endif // VELOCITY_SET_H